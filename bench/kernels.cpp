@@ -0,0 +1,421 @@
+/**
+    Micro-benchmarks of the individual stages of identification, run against
+    the sample data and library in this repository.
+
+    Each benchmark is calibrated to run for at least --min-ms per repetition,
+    then repeated --reps times; the median ns/op is reported with the spread
+    (relative standard deviation) across repetitions, along with heap bytes
+    and allocations per op (counted by a replacement operator new).
+
+    Usage:
+        kernel_bench [--reps n] [--min-ms ms] [--filter regex] [--out results.tsv]
+        kernel_bench --compare baseline.tsv results.tsv
+
+    --compare exits non-zero if any benchmark got slower by more than 5% (or
+    by more than its measured noise, if that is larger), or allocates more.
+*/
+
+#include "Library.h"
+#include "Spectrum.h"
+#include "CSVParser.h"
+#include "StreamRequestJSON.h"
+#include "Util.h"
+
+#include <algorithm>
+#include <functional>
+#include <streambuf>
+#include <istream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <map>
+#include <new>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+using std::map;
+using std::string;
+using std::vector;
+using std::function;
+
+////////////////////////////////////////////////////////////////////////////////
+// Allocation counting
+////////////////////////////////////////////////////////////////////////////////
+
+static std::atomic<uint64_t> allocatedBytes(0);
+static std::atomic<uint64_t> allocationCount(0);
+
+void* operator new(size_t size)
+{
+    allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+
+////////////////////////////////////////////////////////////////////////////////
+// Harness
+////////////////////////////////////////////////////////////////////////////////
+
+//! keeps results alive so the optimizer can't discard the work
+static volatile size_t sink;
+
+struct Result
+{
+    string name;
+    double ns = 0;          //!< median ns/op
+    double spread = 0;      //!< relative std deviation across reps, in %
+    double bytes = 0;       //!< heap bytes allocated per op
+    double allocs = 0;      //!< heap allocations per op
+};
+
+struct Harness
+{
+    int reps = 10;
+    double minMS = 20;
+    string filter;
+    vector<Result> results;
+
+    void run(const string& name, const function<void()>& op)
+    {
+        if (filter.size() && !Util::match(name, filter))
+            return;
+
+        // calibrate: double the batch until one takes at least minMS
+        op();
+        uint64_t batch = 1;
+        while (time(op, batch) < minMS * 1e6 && batch < (1ULL << 30))
+            batch *= 2;
+
+        uint64_t bytes0 = allocatedBytes.load(), allocs0 = allocationCount.load();
+        vector<double> nsPerOp;
+        for (int r = 0; r < reps; r++)
+            nsPerOp.push_back(time(op, batch) / batch);
+        double ops = (double) batch * reps;
+
+        Result result;
+        result.name = name;
+        result.bytes = (allocatedBytes.load() - bytes0) / ops;
+        result.allocs = (allocationCount.load() - allocs0) / ops;
+
+        std::sort(nsPerOp.begin(), nsPerOp.end());
+        result.ns = nsPerOp[nsPerOp.size() / 2];
+        double mean = 0, var = 0;
+        for (double ns : nsPerOp)
+            mean += ns / nsPerOp.size();
+        for (double ns : nsPerOp)
+            var += (ns - mean) * (ns - mean) / nsPerOp.size();
+        result.spread = mean > 0 ? 100 * sqrt(var) / mean : 0;
+
+        printf("%-40s %12.1f %6.1f%% %12.1f %10.2f\n", name.c_str(), result.ns, result.spread, result.bytes, result.allocs);
+        fflush(stdout);
+        results.push_back(result);
+    }
+
+    //! @returns ns to run op 'batch' times
+    static double time(const function<void()>& op, uint64_t batch)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i < batch; i++)
+            op();
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Result files
+////////////////////////////////////////////////////////////////////////////////
+
+static bool save(const string& pathname, const vector<Result>& results)
+{
+    FILE* f = fopen(pathname.c_str(), "w");
+    if (!f)
+        return false;
+    fprintf(f, "# name\tns/op\tspread%%\tbytes/op\tallocs/op\n");
+    for (auto& r : results)
+        fprintf(f, "%s\t%.3f\t%.3f\t%.3f\t%.4f\n", r.name.c_str(), r.ns, r.spread, r.bytes, r.allocs);
+    fclose(f);
+    return true;
+}
+
+static bool load(const string& pathname, vector<Result>& results)
+{
+    std::ifstream in(pathname);
+    if (!in)
+        return false;
+    string line;
+    while (std::getline(in, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+        auto tok = Util::split(line, "\t");
+        if (tok.size() < 5)
+            continue;
+        Result r;
+        r.name   = tok[0];
+        r.ns     = atof(tok[1].c_str());
+        r.spread = atof(tok[2].c_str());
+        r.bytes  = atof(tok[3].c_str());
+        r.allocs = atof(tok[4].c_str());
+        results.push_back(r);
+    }
+    return true;
+}
+
+//! @returns number of regressions
+static int compare(const string& beforePath, const string& afterPath)
+{
+    vector<Result> before, after;
+    if (!load(beforePath, before) || !load(afterPath, after))
+    {
+        fprintf(stderr, "unable to read %s or %s\n", beforePath.c_str(), afterPath.c_str());
+        return -1;
+    }
+
+    map<string, Result> old;
+    for (auto& r : before)
+        old[r.name] = r;
+
+    int regressions = 0;
+    printf("%-40s %12s %12s %8s %12s %12s\n", "benchmark", "old ns/op", "new ns/op", "delta", "old B/op", "new B/op");
+    for (auto& r : after)
+    {
+        auto it = old.find(r.name);
+        if (it == old.end())
+        {
+            printf("%-40s %12s %12.1f %8s %12s %12.1f  (new)\n", r.name.c_str(), "-", r.ns, "", "-", r.bytes);
+            continue;
+        }
+        const Result& o = it->second;
+        double delta = o.ns > 0 ? 100 * (r.ns - o.ns) / o.ns : 0;
+        double noise = std::max(5.0, 2 * (o.spread + r.spread));
+        const char* verdict = "";
+        if (delta > noise || r.allocs > o.allocs + 0.01)
+        {
+            verdict = "  REGRESSION";
+            regressions++;
+        }
+        else if (delta < -noise || r.allocs < o.allocs - 0.01)
+            verdict = "  improved";
+        printf("%-40s %12.1f %12.1f %+7.1f%% %12.1f %12.1f%s\n", r.name.c_str(), o.ns, r.ns, delta, o.bytes, r.bytes, verdict);
+    }
+    return regressions;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Inputs
+////////////////////////////////////////////////////////////////////////////////
+
+//! linearly resample a spectrum to 'pixels' points over the same range
+static Identify::Spectrum resample(const Identify::Spectrum& s, int pixels)
+{
+    Identify::Spectrum out;
+    out.pixels = pixels;
+    out.name = s.name;
+    for (int i = 0; i < pixels; i++)
+    {
+        double x = (double) i * (s.pixels - 1) / (pixels - 1);
+        int j = std::min((int) x, s.pixels - 2);
+        double frac = x - j;
+        out.wavenumbers.push_back((float) (s.wavenumbers[j] + frac * (s.wavenumbers[j + 1] - s.wavenumbers[j])));
+        out.intensities.push_back((float) (s.intensities[j] + frac * (s.intensities[j + 1] - s.intensities[j])));
+    }
+    return out;
+}
+
+//! an istream over an existing buffer, rewound before each op
+struct MemoryBuffer : public std::streambuf
+{
+    MemoryBuffer(const string& s) : s(s) { rewind(); }
+    void rewind()
+    {
+        char* p = const_cast<char*>(s.data());
+        setg(p, p, p + s.size());
+    }
+    const string& s;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Benchmarks
+////////////////////////////////////////////////////////////////////////////////
+
+namespace Identify
+{
+    //! friend of Library, so the private stages can be timed in isolation
+    class KernelBench
+    {
+        public:
+            static void run(Harness& h, const string& libraryPath, const string& dataPath);
+    };
+}
+
+// as BOXCAR_SAMPLE etc in Library.cpp
+#define BOXCAR_SAMPLE             5
+#define MIN_RAMP_PIXELS_SAMPLE    5
+#define MIN_PEAK_HEIGHT_SAMPLE  100
+
+void Identify::KernelBench::run(Harness& h, const string& libraryPath, const string& dataPath)
+{
+    Library library(libraryPath);
+    string samplePath = dataPath + "/Acetone2mmHDPE.csv";
+    Spectrum sample(samplePath);
+    if (sample.pixels < 2 || library.compounds.empty())
+    {
+        fprintf(stderr, "unable to load %s or %s\n", samplePath.c_str(), libraryPath.c_str());
+        exit(1);
+    }
+
+    int sizes[] = { 512, 1024, 2048 };
+
+    // smoothing and peak-finding across typical detector sizes
+    for (int pixels : sizes)
+    {
+        Spectrum s = resample(sample, pixels);
+        h.run(Util::sprintf("boxcar/%d", pixels), [&]()
+        {
+            sink = library.boxcar(s.intensities, BOXCAR_SAMPLE).size();
+        });
+    }
+    for (int pixels : sizes)
+    {
+        Spectrum s = resample(sample, pixels);
+        h.run(Util::sprintf("findPeakWavenumbers/%d", pixels), [&]()
+        {
+            sink = library.findPeakWavenumbers(s, BOXCAR_SAMPLE, MIN_RAMP_PIXELS_SAMPLE, MIN_PEAK_HEIGHT_SAMPLE).size();
+        });
+    }
+
+    // scoring: against one compound, and against the whole library
+    vector<float> samplePeaks = library.findPeakWavenumbers(sample, BOXCAR_SAMPLE, MIN_RAMP_PIXELS_SAMPLE, MIN_PEAK_HEIGHT_SAMPLE);
+    const LibrarySpectrum* richest = &library.compounds[0];
+    for (auto& c : library.compounds)
+        if (c.peakWavenumbers.size() > richest->peakWavenumbers.size() && c.peakWavenumbers.size() <= samplePeaks.size())
+            richest = &c;
+    h.run(Util::sprintf("checkFit/%lu-vs-%lu-peaks", samplePeaks.size(), richest->peakWavenumbers.size()), [&]()
+    {
+        sink = (size_t) library.checkFit(samplePeaks, richest->peakWavenumbers);
+    });
+    h.run(Util::sprintf("checkFit/library-%lu", library.compounds.size()), [&]()
+    {
+        float total = 0;
+        for (auto& c : library.compounds)
+            total += library.checkFit(samplePeaks, c.peakWavenumbers);
+        sink = (size_t) total;
+    });
+
+    // CSV files as saved by ENLIGHTEN (read from the page cache after the first op)
+    h.run("CSVParser/" + Util::basename(samplePath), [&]()
+    {
+        CSVParser parser(samplePath);
+        sink = parser.intensities.size();
+    });
+
+    vector<string> libraryFiles;
+    for (auto& filename : Util::readDir(libraryPath))
+        if (Util::endsWith(filename, ".csv"))
+            libraryFiles.push_back(libraryPath + "/" + filename);
+    h.run("CSVParser/library-" + Util::basename(libraryPath), [&]()
+    {
+        for (auto& pathname : libraryFiles)
+        {
+            CSVParser parser(pathname);
+            sink += parser.intensities.size();
+        }
+    });
+
+    // streaming requests, with and without the wavenumber axis elided
+    for (int pixels : sizes)
+    {
+        Spectrum s = resample(sample, pixels);
+        string json = StreamRequestJSON::toJSON(s);
+        string seed(json);
+        StreamRequestJSON request(seed);
+
+        string elided = json.substr(0, json.find(",\"wavenumbers\":")) + ",\"axis_id\":\"" + request.axis_id + "\"}\n";
+
+        MemoryBuffer full(json);
+        std::istream fullStream(&full);
+        h.run(Util::sprintf("StreamRequestJSON::load/%d", pixels), [&]()
+        {
+            full.rewind();
+            fullStream.clear();
+            request.reload(fullStream);
+            sink = request.spectrum.pixels;
+        });
+
+        MemoryBuffer axis(elided);
+        std::istream axisStream(&axis);
+        h.run(Util::sprintf("StreamRequestJSON::load/%d-axis_id", pixels), [&]()
+        {
+            axis.rewind();
+            axisStream.clear();
+            request.reload(axisStream);
+            sink = request.spectrum.pixels;
+        });
+    }
+
+    // the string helpers CSVParser leans on
+    string header = "Pixel,Wavelength,Wavenumber,Processed,Raw,Dark,Reference";
+    string row = "512,842.15869140625,863.4471435546875,1234.5,5678.25,456.0,0.0";
+    h.run("Util::split/header", [&]() { sink = Util::split(header, ",").size(); });
+    h.run("Util::split/row", [&]() { sink = Util::split(row, ",").size(); });
+    h.run("Util::match/hit", [&]() { sink = Util::match("processed", "processed|spectrum|spectra|intensity"); });
+    h.run("Util::match/miss", [&]() { sink = Util::match("wavelength", "processed|spectrum|spectra|intensity"); });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// main
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv)
+{
+    Harness h;
+    string out;
+    string libraryPath = "../libraries/WP-785";
+    string dataPath = "../data/WP-785";
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg(argv[i]);
+        bool more = i + 1 < argc;
+             if (arg == "--compare" && i + 2 < argc)
+        {
+            int regressions = compare(argv[i + 1], argv[i + 2]);
+            return regressions == 0 ? 0 : 1;
+        }
+        else if (arg == "--reps"    && more) h.reps = std::max(1, atoi(argv[++i]));
+        else if (arg == "--min-ms"  && more) h.minMS = atof(argv[++i]);
+        else if (arg == "--filter"  && more) h.filter = argv[++i];
+        else if (arg == "--out"     && more) out = argv[++i];
+        else if (arg == "--library" && more) libraryPath = argv[++i];
+        else if (arg == "--data"    && more) dataPath = argv[++i];
+        else
+        {
+            printf("Usage: %s [--reps n] [--min-ms ms] [--filter regex] [--out results.tsv] [--library dir] [--data dir]\n", argv[0]);
+            printf("       %s --compare baseline.tsv results.tsv\n", argv[0]);
+            return 1;
+        }
+    }
+
+    printf("%-40s %12s %7s %12s %10s\n", "benchmark", "ns/op", "spread", "bytes/op", "allocs/op");
+    Identify::KernelBench::run(h, libraryPath, dataPath);
+
+    if (out.size() && !save(out, h.results))
+    {
+        fprintf(stderr, "unable to write %s\n", out.c_str());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,108 @@
+/**
+    Measures what a disabled log statement costs inside a checkFit-style inner
+    loop.  The same peak-matching loop is timed with:
+
+    - no log statement at all (baseline)
+    - LOG_TRACE, compiled out because this file sets LOG_LEVEL to DEBUG
+    - LOG_DEBUG, compiled in but disabled at runtime (no --verbose)
+    - a direct Util::log call, which evaluates its arguments (here a
+      Util::join of the sample peaks) before finding logging disabled
+
+    The first three should be indistinguishable.
+*/
+
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+
+#include "Util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <chrono>
+#include <vector>
+
+using std::vector;
+
+#define REPS   20000
+#define TRIALS 5
+
+#define FIT_LOOP(LOG_STATEMENT)                                             \
+    float total = 0;                                                        \
+    for (size_t i = 0; i < libraryPeaks.size(); i++)                        \
+    {                                                                       \
+        float minDist = 1e9;                                                \
+        for (size_t j = 0; j < samplePeaks.size(); j++)                     \
+            minDist = fminf(minDist, fabsf(libraryPeaks[i] - samplePeaks[j])); \
+        LOG_STATEMENT;                                                      \
+        if (minDist < 20)                                                   \
+            total += 1 - minDist / 20;                                      \
+    }                                                                       \
+    return total;
+
+__attribute__((noinline)) float fitNone(const vector<float>& libraryPeaks, const vector<float>& samplePeaks)
+{
+    FIT_LOOP((void) 0)
+}
+
+__attribute__((noinline)) float fitTrace(const vector<float>& libraryPeaks, const vector<float>& samplePeaks)
+{
+    FIT_LOOP(LOG_TRACE("fit: peak %d dist %.2f, sample %s", (int) i, minDist, Util::join(samplePeaks, ", ").c_str()))
+}
+
+__attribute__((noinline)) float fitDebug(const vector<float>& libraryPeaks, const vector<float>& samplePeaks)
+{
+    FIT_LOOP(LOG_DEBUG("fit: peak %d dist %.2f, sample %s", (int) i, minDist, Util::join(samplePeaks, ", ").c_str()))
+}
+
+__attribute__((noinline)) float fitEager(const vector<float>& libraryPeaks, const vector<float>& samplePeaks)
+{
+    FIT_LOOP(Util::log("fit: peak %d dist %.2f, sample %s", (int) i, minDist, Util::join(samplePeaks, ", ").c_str()))
+}
+
+typedef float (*Fit)(const vector<float>&, const vector<float>&);
+
+double timeFit(Fit fit, const vector<float>& libraryPeaks, const vector<float>& samplePeaks, int reps)
+{
+    volatile float sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < reps; i++)
+        sink = sink + fit(libraryPeaks, samplePeaks);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / reps;
+}
+
+int main(int argc, char** argv)
+{
+    Util::logging_enabled = false;
+
+    // typical sizes: ~10 library peaks against ~30 sample peaks
+    srand(1);
+    vector<float> libraryPeaks, samplePeaks;
+    for (int i = 0; i < 10; i++)
+        libraryPeaks.push_back(400 + rand() % 1400);
+    for (int i = 0; i < 30; i++)
+        samplePeaks.push_back(400 + rand() % 1400);
+
+    struct { const char* label; Fit fit; int reps; } cases[] =
+    {
+        { "no log statement",          fitNone,  REPS * 10 },
+        { "LOG_TRACE (compiled out)",  fitTrace, REPS * 10 },
+        { "LOG_DEBUG (disabled)",      fitDebug, REPS * 10 },
+        { "Util::log (disabled)",      fitEager, REPS / 10 },
+    };
+
+    // best of several interleaved trials, to filter out scheduling noise
+    const int count = sizeof(cases) / sizeof(cases[0]);
+    double best[count];
+    for (int trial = 0; trial < TRIALS; trial++)
+        for (int i = 0; i < count; i++)
+        {
+            double ns = timeFit(cases[i].fit, libraryPeaks, samplePeaks, cases[i].reps);
+            best[i] = trial ? fmin(best[i], ns) : ns;
+        }
+
+    for (int i = 0; i < count; i++)
+        printf("%-26s %10.1f ns/call  (%+.1f%%)\n", cases[i].label, best[i], 100 * (best[i] - best[0]) / best[0]);
+    return 0;
+}
@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+"""
+Regression check for awkward --streaming requests.
+
+  check_requests.py [--identify bin/identify] --library libraries/WP-785 data/WP-785/2mmHDPE.csv
+
+Each case is sent to a fresh "identify --streaming" (inline, and with worker
+threads), which must answer with well-formed JSON lines, end with "done" and
+exit cleanly:
+
+- a sample whose peaks lie far beyond any library peak (up to 1e30 cm-1),
+  which must be answered like any other request (@see Library::rankCompounds)
+- lines which aren't JSON objects, which end the session as bad requests
+
+Exits non-zero, listing the failures, if any case misbehaves.  Only the
+standard library is used.
+"""
+
+import argparse
+import json
+import subprocess
+import sys
+
+def load_csv(pathname):
+    """ (wavenumbers, intensities) from an ENLIGHTEN CSV (or a bare 2-column one) """
+    wavenumbers = []
+    intensities = []
+    with open(pathname) as f:
+        for line in f:
+            fields = line.strip().split(",")
+            try:
+                wavenumbers.append(float(fields[0]))
+                intensities.append(float(fields[1]))
+            except (ValueError, IndexError):
+                pass
+    return wavenumbers, intensities
+
+def far_peak_cases(wavenumbers, intensities):
+    """ the sample, with its upper pixels shifted out to absurd wavenumbers """
+    cases = []
+    split = len(wavenumbers) // 3
+    for offset in (3e9, 1e12, 1e30):
+        shifted = [w + (offset if i >= split else 0) for i, w in enumerate(wavenumbers)]
+        request = { "wavenumbers": shifted, "spectrum": intensities, "max_results": 3 }
+        cases.append(("peaks shifted by %g" % offset, [json.dumps(request), json.dumps(dict(request, id="next"))], 2))
+    return cases
+
+def run(args, extra, lines):
+    cmd = [args.identify, "--streaming", "--library", args.library] + extra
+    proc = subprocess.run(cmd, input="".join(line + "\n" for line in lines),
+                          stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, universal_newlines=True, timeout=60)
+    return proc.returncode, proc.stdout.splitlines()
+
+def check(args, name, extra, lines, answers):
+    """ @returns a description of what went wrong, or None """
+    rc, out = run(args, extra, lines)
+    if rc != 0:
+        return "exit code %d" % rc
+    try:
+        responses = [json.loads(line) for line in out]
+    except ValueError:
+        return "malformed response in %s" % out
+    if not responses or responses[0].get("Status") != "ready" or responses[-1].get("Status") != "done":
+        return "missing ready/done in %s" % out
+    results = [r for r in responses if "MatchResult" in r]
+    if len(results) != answers:
+        return "%d responses, expected %d" % (len(results), answers)
+    return None
+
+def main():
+    parser = argparse.ArgumentParser(description="check identify --streaming with awkward requests")
+    parser.add_argument("--identify", default="bin/identify", help="path to the identify binary")
+    parser.add_argument("--library", required=True, help="library to identify against")
+    parser.add_argument("sample", help="ENLIGHTEN CSV to base requests on")
+    args = parser.parse_args()
+
+    cases = far_peak_cases(*load_csv(args.sample))
+    for line in ("42", "[1,2]", "null", "{", "\"text\"", "true"):
+        cases.append(("non-object %s" % line, [line], 0))
+
+    failures = 0
+    for name, lines, answers in cases:
+        for extra in ([], ["--threads", "2"]):
+            problem = check(args, name, extra, lines, answers)
+            label = "%s %s" % (name, " ".join(extra))
+            print("%-40s %s" % (label, problem or "ok"))
+            failures += problem is not None
+    return 1 if failures else 0
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+"""
+Pack many single-spectrum CSVs into one multi-spectrum container.
+
+  pack_spectra.py -o samples.rspc data/WP-785/*.csv
+  pack_spectra.py --format csv -o samples.csv data/WP-785/*.csv
+  pack_spectra.py --repeat 1000 -o big.rspc data/WP-785/*.csv
+
+identify's batch mode loads a container once, parses its wavenumber axis once,
+and identifies every spectrum in it (see SpectrumContainer.h):
+
+- rspc: "RSPC", u32 version (1), u32 pixels, u32 count, f32 wavenumbers, then
+        per spectrum u16 name length, name, zero padding to a 4-byte offset,
+        and f32 intensities (all little-endian)
+- csv:  an ENLIGHTEN-style multi-column export: a Label row naming each
+        spectrum, then Wavenumber,Processed,Processed,...
+
+Every spectrum must share the first one's axis (same pixel count, and
+wavenumbers within --tolerance); others are skipped with a warning.
+"""
+
+import argparse
+import os
+import struct
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from replay import load_csv
+
+MAGIC = b"RSPC"
+VERSION = 1
+
+def label(pathname):
+    """ the Label row's value, or the file's basename, as identify names it """
+    with open(pathname) as f:
+        for line in f:
+            tok = [t.strip() for t in line.strip().split(',')]
+            if tok[0].lower() == "label" and len(tok) > 1:
+                return tok[1]
+            if tok[0].lower() == "wavenumber":
+                break
+    return os.path.splitext(os.path.basename(pathname))[0]
+
+def write_rspc(pathname, axis, spectra):
+    with open(pathname, "wb") as f:
+        f.write(MAGIC + struct.pack("<III", VERSION, len(axis), len(spectra)))
+        f.write(struct.pack("<%df" % len(axis), *axis))
+        for name, intensities in spectra:
+            encoded = name.encode()[:0xffff]
+            f.write(struct.pack("<H", len(encoded)) + encoded)
+            f.write(b"\0" * (-f.tell() % 4))
+            f.write(struct.pack("<%df" % len(axis), *intensities))
+
+def write_csv(pathname, axis, spectra):
+    with open(pathname, "w") as f:
+        f.write("Label,%s\n\n" % ",".join(name.replace(",", " ") for name, _ in spectra))
+        f.write("Wavenumber,%s\n" % ",".join(["Processed"] * len(spectra)))
+        for i, x in enumerate(axis):
+            f.write("%.2f,%s\n" % (x, ",".join("%.2f" % s[1][i] for s in spectra)))
+
+def main():
+    parser = argparse.ArgumentParser(description="pack CSV spectra into one container")
+    parser.add_argument("files", nargs="+", help="single-spectrum CSVs (directories are skipped)")
+    parser.add_argument("-o", "--output", required=True)
+    parser.add_argument("--format", choices=["rspc", "csv"], default="rspc")
+    parser.add_argument("--repeat", type=int, default=1, help="include every spectrum this many times (for benchmarking)")
+    parser.add_argument("--tolerance", type=float, default=0.01, help="max wavenumber difference from the first axis (cm-1)")
+    args = parser.parse_args()
+
+    axis = None
+    spectra = []
+    for pathname in args.files:
+        if os.path.isdir(pathname):
+            continue
+        wn, inten = load_csv(pathname)
+        if len(wn) < 2:
+            print("skipping %s (no spectrum)" % pathname, file=sys.stderr)
+            continue
+        if axis is None:
+            axis = wn
+        elif len(wn) != len(axis) or any(abs(a - b) > args.tolerance for a, b in zip(wn, axis)):
+            print("skipping %s (different wavenumber axis)" % pathname, file=sys.stderr)
+            continue
+        spectra.append((label(pathname), inten))
+    if not spectra:
+        sys.exit("no spectra found")
+
+    spectra = spectra * args.repeat
+    (write_rspc if args.format == "rspc" else write_csv)(args.output, axis, spectra)
+    print("packed %d spectra of %d pixels into %s" % (len(spectra), len(axis), args.output), file=sys.stderr)
+
+if __name__ == "__main__":
+    main()
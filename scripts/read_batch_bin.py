@@ -0,0 +1,55 @@
+#!/usr/bin/env python3
+"""
+Decode "identify --output-format bin" results to NDJSON.
+
+  identify --output-format bin --max-results 5 --output results.bin ...
+  read_batch_bin.py results.bin
+
+See src/BatchWriter.h for the layout (native-endian; little-endian assumed).
+"""
+
+import json
+import struct
+import sys
+
+def records(f):
+    data = f.read()
+    if data[:4] != b"RIDB":
+        sys.exit("not an identify batch file")
+    version, max_results, flags, count = struct.unpack_from("<IIII", data, 4)
+    if version != 1:
+        sys.exit("unsupported version %d" % version)
+    pos = 20
+
+    def text():
+        nonlocal pos
+        n, = struct.unpack_from("<H", data, pos)
+        s = data[pos + 2 : pos + 2 + n].decode("utf-8", "replace")
+        pos += 2 + n
+        return s
+
+    compounds = [text() for i in range(count)]
+    while pos < len(data):
+        record = { "Sample": text(), "Path": text(), "MatchResult": [] }
+        matches = data[pos]
+        pos += 1
+        for i in range(matches):
+            index, score = struct.unpack_from("<If", data, pos)
+            pos += 8
+            record["MatchResult"].append({ "Name": compounds[index], "Score": round(score, 2) })
+        if flags & 1:
+            stages = struct.unpack_from("<5f", data, pos)
+            pos += 20
+            record["Timing"] = dict(zip(("Load", "Boxcar", "Peaks", "Scan", "Output"), (round(s, 1) for s in stages)))
+        yield record
+
+def main():
+    if len(sys.argv) < 2:
+        print("Usage: read_batch_bin.py results.bin")
+        sys.exit()
+    with open(sys.argv[1], "rb") as f:
+        for record in records(f):
+            print(json.dumps(record))
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,320 @@
+#!/usr/bin/env python3
+"""
+Load generator standing in for the ENLIGHTEN RamanID plug-in.
+
+  replay.py generate [options] data/WP-785/*.csv > capture.jsonl
+  replay.py replay   [options] --library libraries/WP-785 capture.jsonl
+
+"generate" builds a synthetic NDJSON capture from ENLIGHTEN CSVs, with
+optional noise, peak-shift and intensity-scale augmentation.  Each line is an
+ordinary --streaming request plus a "t" field (seconds since the start of the
+capture), which identify ignores.
+
+"replay" spawns "identify --streaming", waits for its "ready" line, then sends
+the capture at its recorded pacing ("t"), at a fixed --rate, or as fast as
+possible (--max).  Responses are matched to requests (by "id" if present,
+otherwise in order) and latency percentiles are reported along with the
+handshake time.  Only the standard library is used.
+"""
+
+import argparse
+import json
+import os
+import random
+import subprocess
+import sys
+import threading
+import time
+from collections import deque
+
+################################################################################
+# generate
+################################################################################
+
+def load_csv(pathname):
+    """ (wavenumbers, intensities) from an ENLIGHTEN CSV (or a bare 2-column one) """
+    wavenumbers = []
+    intensities = []
+    col_wn, col_int = 0, 1
+    with open(pathname) as f:
+        for line in f:
+            tok = [t.strip() for t in line.strip().split(',')]
+            if not tok or not tok[0]:
+                continue
+            if not (tok[0][0].isdigit() or tok[0][0] == '-'):
+                lower = [t.lower() for t in tok]
+                if "wavenumber" in lower:
+                    col_wn = lower.index("wavenumber")
+                    for i, t in enumerate(lower):
+                        if t in ("processed", "spectrum", "spectra", "intensity"):
+                            col_int = i
+                continue
+            if len(tok) <= max(col_wn, col_int):
+                continue
+            try:
+                wavenumbers.append(float(tok[col_wn]))
+                intensities.append(float(tok[col_int]))
+            except ValueError:
+                pass
+    return wavenumbers, intensities
+
+def shifted(wavenumbers, intensities, shift):
+    """ the spectrum's peaks moved by 'shift' cm-1 along the same axis """
+    if shift == 0:
+        return list(intensities)
+    out = []
+    n = len(wavenumbers)
+    j = 0
+    for x in wavenumbers:
+        src = x - shift
+        while j < n - 2 and wavenumbers[j + 1] < src:
+            j += 1
+        while j > 0 and wavenumbers[j] > src:
+            j -= 1
+        x0, x1 = wavenumbers[j], wavenumbers[j + 1]
+        frac = 0 if x1 == x0 else min(1, max(0, (src - x0) / (x1 - x0)))
+        out.append(intensities[j] + frac * (intensities[j + 1] - intensities[j]))
+    return out
+
+def generate(args):
+    rng = random.Random(args.seed)
+    samples = []
+    for pathname in args.files:
+        if os.path.isdir(pathname):
+            continue
+        wn, inten = load_csv(pathname)
+        if len(wn) > 1:
+            samples.append((os.path.basename(pathname), wn, inten))
+        else:
+            print("skipping %s (no spectrum)" % pathname, file=sys.stderr)
+    if not samples:
+        sys.exit("no spectra found")
+
+    lo, hi = args.scale
+    out = open(args.output, "w") if args.output else sys.stdout
+    t = 0.0
+    for i in range(args.count):
+        name, wn, inten = rng.choice(samples)
+        shift = rng.uniform(-args.shift, args.shift) if args.shift else 0
+        scale = rng.uniform(lo, hi)
+        spectrum = shifted(wn, inten, shift)
+        spectrum = [round(max(0, v * scale + (rng.gauss(0, args.noise) if args.noise else 0)), 2) for v in spectrum]
+
+        request = { "t": round(t, 6) }
+        if args.ids:
+            request["id"] = i
+        request["max_results"] = args.max_results
+        request["spectrum"] = spectrum
+        request["wavenumbers"] = wn
+        out.write(json.dumps(request, separators=(',', ':')) + "\n")
+
+        # exponential inter-arrival times around the mean rate, or a fixed period
+        period = 1.0 / args.rate
+        t += rng.expovariate(args.rate) if args.jitter else period
+    if out is not sys.stdout:
+        out.close()
+
+################################################################################
+# replay
+################################################################################
+
+def percentile(sorted_values, q):
+    if not sorted_values:
+        return 0
+    return sorted_values[min(len(sorted_values) - 1, int(q * len(sorted_values)))]
+
+class Session:
+    """ one identify --streaming child, with a thread matching its responses """
+
+    def __init__(self, cmd):
+        self.started = time.perf_counter()
+        self.proc = subprocess.Popen(cmd, stdin=subprocess.PIPE, stdout=subprocess.PIPE, bufsize=0)
+        self.lock = threading.Lock()
+        self.by_id = {}           # id token -> send time
+        self.in_order = deque()   # send times of requests without an id
+        self.latencies = []       # seconds
+        self.counts = { "responses": 0, "errors": 0, "skipped": 0, "partial": 0, "unmatched": 0 }
+        self.ready = threading.Event()
+        self.finished = threading.Event()
+        self.handshake = None
+        self.reader = threading.Thread(target=self.read, daemon=True)
+        self.reader.start()
+
+    def read(self):
+        for line in self.proc.stdout:
+            now = time.perf_counter()
+            try:
+                response = json.loads(line)
+            except ValueError:
+                continue
+            status = response.get("Status")
+            if status == "ready":
+                self.handshake = now - self.started
+                self.ready.set()
+                continue
+            if status == "done":
+                break
+            with self.lock:
+                if "id" in response:
+                    sent = self.by_id.pop(json.dumps(response["id"]), None)
+                else:
+                    sent = self.in_order.popleft() if self.in_order else None
+                self.counts["responses"] += 1
+                if sent is None:
+                    self.counts["unmatched"] += 1
+                elif "Error" in response:
+                    self.counts["errors"] += 1
+                elif status == "skipped":
+                    self.counts["skipped"] += 1
+                else:
+                    if response.get("partial"):
+                        self.counts["partial"] += 1
+                    self.latencies.append(now - sent)
+        self.ready.set()
+        self.finished.set()
+
+    def send(self, request):
+        line = (json.dumps(request, separators=(',', ':')) + "\n").encode()
+        with self.lock:
+            now = time.perf_counter()
+            if "id" in request:
+                self.by_id[json.dumps(request["id"])] = now
+            else:
+                self.in_order.append(now)
+        self.proc.stdin.write(line)
+
+    def close(self, timeout):
+        self.proc.stdin.close()
+        self.finished.wait(timeout)
+        try:
+            self.proc.wait(timeout)
+        except subprocess.TimeoutExpired:
+            self.proc.kill()
+
+def load_capture(pathname):
+    requests = []
+    with open(pathname) as f:
+        for line in f:
+            line = line.strip()
+            if line:
+                requests.append(json.loads(line))
+    return requests
+
+def replay(args):
+    requests = load_capture(args.capture)
+    if not requests:
+        sys.exit("empty capture")
+
+    # pacing: seconds after the first send at which each request goes out
+    if args.max:
+        schedule = [0] * len(requests)
+        mode = "max"
+    elif args.rate:
+        schedule = [i / args.rate for i in range(len(requests))]
+        mode = "%g req/s" % args.rate
+    else:
+        t0 = requests[0].get("t", 0)
+        schedule = [(r.get("t", 0) - t0) / args.speed for r in requests]
+        mode = "recorded x%g" % args.speed
+
+    for i, r in enumerate(requests):
+        r.pop("t", None)
+        if args.ids and "id" not in r:
+            r["id"] = i
+
+    cmd = [args.identify, "--streaming", "--library", args.library] + args.extra
+    session = Session(cmd)
+    if not session.ready.wait(args.timeout) or session.handshake is None:
+        session.proc.kill()
+        sys.exit("identify did not report ready within %gs" % args.timeout)
+
+    start = time.perf_counter()
+    for when, request in zip(schedule, requests):
+        delay = start + when - time.perf_counter()
+        if delay > 0:
+            time.sleep(delay)
+        session.send(request)
+    sent = time.perf_counter() - start
+    session.close(args.timeout)
+    elapsed = time.perf_counter() - start
+
+    us = sorted(x * 1e6 for x in session.latencies)
+    report = {
+        "Mode": mode,
+        "Requests": len(requests),
+        "HandshakeMS": round(session.handshake * 1e3, 2),
+        "SendSeconds": round(sent, 3),
+        "Seconds": round(elapsed, 3),
+        "RequestsPerSec": round(len(requests) / elapsed, 1) if elapsed > 0 else 0,
+        "LatencyUS": {
+            "Count": len(us),
+            "Mean": round(sum(us) / len(us), 1) if us else 0,
+            "P50": round(percentile(us, 0.5), 1),
+            "P90": round(percentile(us, 0.9), 1),
+            "P99": round(percentile(us, 0.99), 1),
+            "Max": round(us[-1], 1) if us else 0,
+        },
+    }
+    for key, value in session.counts.items():
+        report[key.capitalize()] = value
+    report["Missing"] = len(requests) - session.counts["responses"]
+
+    if args.json:
+        print(json.dumps(report))
+        return
+
+    lat = report["LatencyUS"]
+    print("replayed %d requests (%s) in %.3f s: %.1f req/s, handshake %.1f ms"
+        % (len(requests), mode, elapsed, report["RequestsPerSec"], report["HandshakeMS"]))
+    print("latency: mean %.1f us, p50 %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us (%d matched)"
+        % (lat["Mean"], lat["P50"], lat["P90"], lat["P99"], lat["Max"], lat["Count"]))
+    print("errors %d, skipped %d, partial %d, unmatched %d, missing %d"
+        % (report["Errors"], report["Skipped"], report["Partial"], report["Unmatched"], report["Missing"]))
+
+################################################################################
+# main
+################################################################################
+
+def main():
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    parser = argparse.ArgumentParser(description="load generator for identify --streaming")
+    sub = parser.add_subparsers(dest="command")
+
+    g = sub.add_parser("generate", help="synthesize a capture from ENLIGHTEN CSVs")
+    g.add_argument("files", nargs="+", help="CSV files (directories are skipped)")
+    g.add_argument("-o", "--output", help="write here instead of stdout")
+    g.add_argument("--count", type=int, default=1000, help="requests to generate (default 1000)")
+    g.add_argument("--rate", type=float, default=10, help="mean requests/sec recorded in 't' (default 10)")
+    g.add_argument("--jitter", action="store_true", help="Poisson arrivals instead of a fixed period")
+    g.add_argument("--noise", type=float, default=0, help="gaussian noise sigma, in counts")
+    g.add_argument("--shift", type=float, default=0, help="shift peaks by up to +/- this many cm-1")
+    g.add_argument("--scale", type=float, nargs=2, default=[1, 1], metavar=("LO", "HI"), help="scale intensities by a random factor in [LO, HI]")
+    g.add_argument("--max-results", type=int, default=5)
+    g.add_argument("--ids", action="store_true", help="give each request an id (answered by the worker pool)")
+    g.add_argument("--seed", type=int, default=1)
+
+    r = sub.add_parser("replay", help="drive identify --streaming with a capture")
+    r.add_argument("capture", help="NDJSON capture (e.g. from 'generate')")
+    r.add_argument("--library", default=os.path.join(root, "libraries", "WP-785"))
+    r.add_argument("--identify", default=os.path.join(root, "bin", "identify"))
+    pace = r.add_mutually_exclusive_group()
+    pace.add_argument("--speed", type=float, default=1, help="replay recorded pacing this many times faster (default 1)")
+    pace.add_argument("--rate", type=float, help="send at a fixed rate (req/s), ignoring recorded times")
+    pace.add_argument("--max", action="store_true", help="send as fast as possible")
+    r.add_argument("--ids", action="store_true", help="add an id to requests lacking one")
+    r.add_argument("--timeout", type=float, default=30, help="seconds to wait for ready/done (default 30)")
+    r.add_argument("--json", action="store_true", help="report as one line of JSON")
+    r.add_argument("extra", nargs=argparse.REMAINDER, help="further identify options, after --")
+
+    args = parser.parse_args()
+    if args.command == "generate":
+        generate(args)
+    elif args.command == "replay":
+        if args.extra and args.extra[0] == "--":
+            args.extra = args.extra[1:]
+        replay(args)
+    else:
+        parser.print_help()
+
+if __name__ == "__main__":
+    main()
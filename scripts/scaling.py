@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+"""
+How library load time, memory and identification latency scale with size.
+
+  scaling.py [--sizes 1000 10000 100000 1000000] [--plot scaling.png]
+
+For each size, synth_library.py generates a compiled library (or, with
+--format csv, a directory of CSVs) including the real compounds, and
+"identify --bench" is run against it with the bundled samples.  The results
+are printed as a table (and --json lines); with --plot, and if matplotlib is
+installed, they are also plotted log-log.
+"""
+
+import argparse
+import glob
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import synth_library
+
+COLUMNS = [
+    ("compounds",   "%10d",   lambda b: b["Compounds"]),
+    ("load s",      "%9.3f",  lambda b: b["LoadSeconds"]),
+    ("library KB",  "%11d",   lambda b: b["LibraryKB"]),
+    ("load RSS KB", "%12d",   lambda b: b["LoadRSSKB"]),
+    ("peak RSS KB", "%12d",   lambda b: b["PeakRSSKB"]),
+    ("p50 us",      "%11.1f", lambda b: b["Identify"]["P50"]),
+    ("p99 us",      "%11.1f", lambda b: b["Identify"]["P99"]),
+    ("req/s",       "%10.1f", lambda b: b["Identify"]["RequestsPerSec"]),
+    ("stream p50",  "%11.1f", lambda b: b["Streaming"]["P50"]),
+]
+
+def bench(identify, library, samples, iterations):
+    cmd = [identify, "--bench", "--iterations", str(iterations), "--library", library] + samples
+    out = subprocess.run(cmd, stdout=subprocess.PIPE, check=True, universal_newlines=True).stdout
+    for line in reversed(out.splitlines()):
+        if line.startswith("{"):
+            return json.loads(line)["Bench"]
+    sys.exit("no results from %s" % " ".join(cmd))
+
+def plot(results, pathname):
+    try:
+        import matplotlib
+        matplotlib.use("Agg")
+        import matplotlib.pyplot as plt
+    except ImportError:
+        print("matplotlib not installed; skipping %s" % pathname, file=sys.stderr)
+        return
+
+    sizes = [b["Compounds"] for b in results]
+    fig, axes = plt.subplots(1, 3, figsize=(15, 4.5))
+    panels = [
+        ("load time (s)",        [("load", [b["LoadSeconds"] for b in results])]),
+        ("memory (KB)",          [("library", [b["LibraryKB"] for b in results]),
+                                  ("peak RSS", [b["PeakRSSKB"] for b in results])]),
+        ("identify latency (us)", [("p50", [b["Identify"]["P50"] for b in results]),
+                                  ("p99", [b["Identify"]["P99"] for b in results]),
+                                  ("streaming p50", [b["Streaming"]["P50"] for b in results])]),
+    ]
+    for ax, (title, series) in zip(axes, panels):
+        for label, values in series:
+            ax.loglog(sizes, [max(v, 1e-6) for v in values], marker="o", label=label)
+        ax.set_title(title)
+        ax.set_xlabel("compounds")
+        ax.grid(True, which="both", alpha=0.3)
+        ax.legend()
+    fig.tight_layout()
+    fig.savefig(pathname)
+    print("wrote %s" % pathname)
+
+def main():
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    parser = argparse.ArgumentParser(description="benchmark identify against growing synthetic libraries")
+    parser.add_argument("--sizes", type=int, nargs="+", default=[1000, 10000, 100000], help="synthetic compounds per library")
+    parser.add_argument("--format", choices=["peaks", "csv"], default="peaks", help="library format to load (default peaks)")
+    parser.add_argument("--samples", nargs="+", help="sample CSVs (default data/WP-785/*.csv)")
+    parser.add_argument("--iterations", type=int, default=3, help="--bench iterations per sample (default 3)")
+    parser.add_argument("--identify", default=os.path.join(root, "bin", "identify"))
+    parser.add_argument("--workdir", help="keep generated libraries here (default: a temporary directory)")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--plot", help="save a plot here (needs matplotlib)")
+    parser.add_argument("--json", action="store_true", help="also print each result as a line of JSON")
+    args = parser.parse_args()
+
+    samples = args.samples or sorted(glob.glob(os.path.join(root, "data", "WP-785", "*.csv")))
+    stats = synth_library.Stats(synth_library.default_dirs(root))
+
+    tmp = None
+    if args.workdir:
+        os.makedirs(args.workdir, exist_ok=True)
+        workdir = args.workdir
+    else:
+        tmp = tempfile.TemporaryDirectory()
+        workdir = tmp.name
+
+    print(" ".join(("%" + str(len(fmt % 0) if "d" in fmt else len(fmt % 0.0)) + "s") % name for name, fmt, _ in COLUMNS))
+    results = []
+    for size in args.sizes:
+        library = os.path.join(workdir, "synthetic-%d%s" % (size, ".peaks" if args.format == "peaks" else ""))
+        if not os.path.exists(library):
+            synth_library.generate(None, size, args.format, library, args.seed, True, stats)
+        b = bench(args.identify, library, samples, args.iterations)
+        results.append(b)
+        print(" ".join(fmt % get(b) for _, fmt, get in COLUMNS))
+        if args.json:
+            print(json.dumps(b))
+        sys.stdout.flush()
+
+    if args.plot:
+        plot(results, args.plot)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,248 @@
+#!/usr/bin/env python3
+"""
+Generate large synthetic libraries for scaling studies.
+
+  synth_library.py --count 100000 -o /tmp/lib100k.peaks
+  synth_library.py --count 1000 --format csv -o /tmp/lib1k
+
+Peaks are found in the real libraries (--from, default every directory under
+libraries/) with the same boxcar / ramp / height rules Library uses, and their
+per-compound counts, positions, widths and heights become the distributions
+that synthetic compounds are drawn from.
+
+--format peaks writes a compiled library: one line per compound, its name
+then its peak wavenumbers, which identify --library loads without reading or
+peak-finding any spectra.  --format csv writes a directory of ENLIGHTEN-style
+CSVs with Lorentzian peaks on a sloping baseline, plus noise, for measuring the
+CSV load path as well.  --include-real adds the source compounds themselves, so
+the bundled samples still identify against the synthetic library.
+"""
+
+import argparse
+import os
+import random
+import shutil
+import sys
+
+# Library's parameters for library spectra (src/Library.cpp)
+BOXCAR_LIBRARY = 10
+MIN_RAMP_PIXELS_LIBRARY = 15
+MIN_PEAK_HEIGHT_LIBRARY = 500
+
+MIN_PEAK_SEPARATION = 15 # cm-1; closer peaks would merge after smoothing
+
+def load_csv(pathname):
+    """ (label, wavenumbers, intensities) from an ENLIGHTEN CSV """
+    label = os.path.splitext(os.path.basename(pathname))[0]
+    wavenumbers = []
+    intensities = []
+    state = "metadata"
+    col_wn, col_int = 0, 1
+    with open(pathname) as f:
+        for line in f:
+            tok = [t.strip() for t in line.strip().split(',')]
+            if state == "metadata":
+                if tok[0] == "Label" and len(tok) > 1 and tok[1]:
+                    label = tok[1]
+                lower = [t.lower() for t in tok]
+                if "wavenumber" in lower:
+                    col_wn = lower.index("wavenumber")
+                    if "processed" in lower:
+                        col_int = lower.index("processed")
+                    state = "data"
+            elif len(tok) > max(col_wn, col_int):
+                try:
+                    wavenumbers.append(float(tok[col_wn]))
+                    intensities.append(float(tok[col_int]))
+                except ValueError:
+                    pass
+    return label, wavenumbers, intensities
+
+def boxcar(a, half_width):
+    n = len(a)
+    out = list(a)
+    for i in range(half_width, n - half_width):
+        out[i] = sum(a[i - half_width : i + half_width + 1]) / (half_width * 2 + 1)
+    return out
+
+def find_peaks(smoothed, min_ramp, min_height):
+    """ pixel indices of peaks, as Library::findPeaks """
+    peaks = []
+    ramp = 0
+    base = smoothed[0]
+    for i in range(1, len(smoothed) - min_ramp):
+        if smoothed[i] > smoothed[i - 1]:
+            ramp += 1
+            if ramp >= min_ramp:
+                if all(smoothed[j] > smoothed[j + 1] for j in range(i, i + min_ramp)):
+                    if smoothed[i] >= base + min_height:
+                        peaks.append(i)
+        else:
+            ramp = 0
+            base = smoothed[0]
+    return peaks
+
+def describe_peak(wavenumbers, smoothed, i):
+    """ (height above the local minima, FWHM in cm-1) of the peak at pixel i """
+    left = i
+    while left > 0 and smoothed[left - 1] < smoothed[left]:
+        left -= 1
+    right = i
+    while right < len(smoothed) - 1 and smoothed[right + 1] < smoothed[right]:
+        right += 1
+    floor = max(smoothed[left], smoothed[right])
+    height = smoothed[i] - floor
+    half = floor + height / 2
+    lo = i
+    while lo > left and smoothed[lo] > half:
+        lo -= 1
+    hi = i
+    while hi < right and smoothed[hi] > half:
+        hi += 1
+    return height, max(1.0, wavenumbers[hi] - wavenumbers[lo])
+
+class Stats:
+    """ peak distributions drawn from real library spectra """
+
+    def __init__(self, dirs):
+        self.compounds = []  # (name, [peak wavenumbers])
+        self.sources = []    # pathname of each of those compounds
+        self.counts = []
+        self.positions = []
+        self.widths = []
+        self.heights = []
+        self.axis = None
+        self.template = None # metadata lines of the first CSV, for --format csv
+        names = set()
+        for d in dirs:
+            for filename in sorted(os.listdir(d)):
+                if filename.startswith('.') or not filename.endswith(".csv"):
+                    continue
+                pathname = os.path.join(d, filename)
+                label, wn, inten = load_csv(pathname)
+                if len(wn) < 2 * MIN_RAMP_PIXELS_LIBRARY:
+                    continue
+                smoothed = boxcar(inten, BOXCAR_LIBRARY)
+                peaks = find_peaks(smoothed, MIN_RAMP_PIXELS_LIBRARY, MIN_PEAK_HEIGHT_LIBRARY)
+                if not peaks:
+                    continue
+                if label not in names:
+                    names.add(label)
+                    self.compounds.append((label, [wn[i] for i in peaks]))
+                    self.sources.append(pathname)
+                if self.axis is None:
+                    self.axis = wn
+                    self.template = pathname
+                self.counts.append(len(peaks))
+                for i in peaks:
+                    height, width = describe_peak(wn, smoothed, i)
+                    self.positions.append(wn[i])
+                    self.widths.append(width)
+                    self.heights.append(height)
+        if not self.counts:
+            sys.exit("no library peaks found in %s" % ", ".join(dirs))
+
+    def summary(self):
+        def span(v):
+            v = sorted(v)
+            return "min %.1f, median %.1f, max %.1f" % (v[0], v[len(v) // 2], v[-1])
+        return "\n".join([
+            "%d spectra, %d compounds, %d peaks" % (len(self.counts), len(self.compounds), len(self.positions)),
+            "peaks/compound: %s" % span(self.counts),
+            "position cm-1:  %s" % span(self.positions),
+            "FWHM cm-1:      %s" % span(self.widths),
+            "height:         %s" % span(self.heights)])
+
+    def compound(self, rng):
+        """ [(wavenumber, height, width)] for one synthetic compound """
+        lo, hi = self.axis[0] + 50, self.axis[-1] - 50
+        n = max(1, rng.choice(self.counts) + rng.randint(-1, 1))
+        peaks = []
+        for attempt in range(20 * n):
+            if len(peaks) == n:
+                break
+            position = min(hi, max(lo, rng.choice(self.positions) + rng.uniform(-25, 25)))
+            if any(abs(position - p[0]) < MIN_PEAK_SEPARATION for p in peaks):
+                continue
+            peaks.append((position, rng.choice(self.heights), rng.choice(self.widths)))
+        return sorted(peaks)
+
+def render(axis, peaks, rng):
+    """ intensities of Lorentzian peaks on a sloping baseline, with noise """
+    offset = rng.uniform(0, 400)
+    slope = rng.uniform(-0.2, 0.2)
+    out = []
+    for x in axis:
+        y = offset + slope * (x - axis[0])
+        for position, height, width in peaks:
+            d = (x - position) / (width / 2)
+            y += height / (1 + d * d)
+        out.append(max(0.0, y + rng.gauss(0, 10)))
+    return out
+
+def write_peaks(stats, count, pathname, rng, include_real):
+    with open(pathname, "w") as f:
+        f.write("# synthetic library: %d compounds\n" % count)
+        if include_real:
+            for name, peaks in stats.compounds:
+                f.write("%s,%s\n" % (name, ",".join("%.2f" % p for p in peaks)))
+        for i in range(count):
+            peaks = stats.compound(rng)
+            f.write("synthetic-%07d,%s\n" % (i, ",".join("%.2f" % p[0] for p in peaks)))
+
+def write_csvs(stats, count, dirname, rng, include_real):
+    os.makedirs(dirname, exist_ok=True)
+    header = []
+    with open(stats.template) as f:
+        for line in f:
+            if line.strip().strip(",") == "" or line.startswith("Wavenumber"):
+                break # (ENLIGHTEN's blank line may be just commas)
+            if not line.startswith("Label,"):
+                header.append(line)
+    if include_real:
+        for pathname in stats.sources:
+            shutil.copy(pathname, dirname)
+    for i in range(count):
+        name = "synthetic-%07d" % i
+        spectrum = render(stats.axis, stats.compound(rng), rng)
+        with open(os.path.join(dirname, name + ".csv"), "w") as f:
+            f.writelines(header)
+            f.write("Label,%s\n\nWavenumber,Processed\n" % name)
+            for x, y in zip(stats.axis, spectrum):
+                f.write("%.2f,%.2f\n" % (x, y))
+
+def generate(dirs, count, fmt, output, seed=1, include_real=False, stats=None):
+    """ write a library of 'count' synthetic compounds to 'output' """
+    stats = stats or Stats(dirs)
+    rng = random.Random(seed)
+    if fmt == "peaks":
+        write_peaks(stats, count, output, rng, include_real)
+    else:
+        write_csvs(stats, count, output, rng, include_real)
+    return stats
+
+def default_dirs(root):
+    libraries = os.path.join(root, "libraries")
+    return [os.path.join(libraries, d) for d in sorted(os.listdir(libraries)) if os.path.isdir(os.path.join(libraries, d))]
+
+def main():
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    parser = argparse.ArgumentParser(description="generate a synthetic library")
+    parser.add_argument("-o", "--output", help="peak-list file, or directory for --format csv")
+    parser.add_argument("--count", type=int, default=10000, help="synthetic compounds (default 10000)")
+    parser.add_argument("--format", choices=["peaks", "csv"], default="peaks")
+    parser.add_argument("--from", dest="dirs", action="append", help="library directory to model (default: all of libraries/)")
+    parser.add_argument("--include-real", action="store_true", help="also include the source compounds")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--stats", action="store_true", help="just print the source distributions")
+    args = parser.parse_args()
+
+    stats = Stats(args.dirs or default_dirs(root))
+    if args.stats or not args.output:
+        print(stats.summary())
+        if not args.output:
+            return
+    generate(None, args.count, args.format, args.output, args.seed, args.include_real, stats)
+
+if __name__ == "__main__":
+    main()
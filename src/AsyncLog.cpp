@@ -0,0 +1,270 @@
+#include "AsyncLog.h"
+
+#include <time.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+
+using std::atomic;
+using std::mutex;
+using std::string;
+using std::vector;
+using std::unique_lock;
+
+#define RING_BYTES   (1 << 20)          // per-thread queue capacity
+#define MAX_RECORD   (RING_BYTES / 4)   // longer messages are truncated
+#define SCRATCH_LEN  1024               // most messages format without allocating
+#define DRAIN_MS     5                  // writer wakes at least this often
+
+namespace
+{
+    /*! One producer thread's queue: length-prefixed records in a byte ring.
+
+        head and tail count bytes ever written / consumed, so head - tail is
+        the fill level and neither index needs wrapping.  They are kept on
+        separate cache lines so the producer and writer don't contend.
+    */
+    struct Ring
+    {
+        atomic<uint64_t> head;
+        char pad1[64];
+        atomic<uint64_t> tail;
+        char pad2[64];
+        atomic<uint64_t> dropped;
+        atomic<bool> retired;       //!< owning thread has exited
+        uint64_t reported = 0;      //!< drops already logged (writer only)
+        char data[RING_BYTES];
+
+        Ring() : head(0), tail(0), dropped(0), retired(false) {}
+
+        void copyIn(uint64_t pos, const void* src, size_t len)
+        {
+            size_t offset = pos % RING_BYTES;
+            size_t first = len < RING_BYTES - offset ? len : RING_BYTES - offset;
+            memcpy(data + offset, src, first);
+            memcpy(data, (const char*) src + first, len - first);
+        }
+
+        void copyOut(uint64_t pos, void* dst, size_t len) const
+        {
+            size_t offset = pos % RING_BYTES;
+            size_t first = len < RING_BYTES - offset ? len : RING_BYTES - offset;
+            memcpy(dst, data + offset, first);
+            memcpy((char*) dst + first, data, len - first);
+        }
+
+        //! producer side; never blocks
+        void push(const char* text, uint32_t len)
+        {
+            uint64_t h = head.load(std::memory_order_relaxed);
+            uint64_t t = tail.load(std::memory_order_acquire);
+            if (RING_BYTES - (h - t) < sizeof(len) + len)
+            {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            copyIn(h, &len, sizeof(len));
+            copyIn(h + sizeof(len), text, len);
+            head.store(h + sizeof(len) + len, std::memory_order_release);
+        }
+
+        //! writer side; appends each queued record to out as a log line
+        void drain(string& out, const string& prefix)
+        {
+            uint64_t t = tail.load(std::memory_order_relaxed);
+            uint64_t h = head.load(std::memory_order_acquire);
+            while (t < h)
+            {
+                uint32_t len;
+                copyOut(t, &len, sizeof(len));
+                out += prefix;
+                size_t end = out.size();
+                out.resize(end + len);
+                copyOut(t + sizeof(len), &out[end], len);
+                out += '\n';
+                t += sizeof(len) + len;
+            }
+            tail.store(t, std::memory_order_release);
+        }
+    };
+
+    //! The writer thread and the registry of per-thread rings.
+    struct Writer
+    {
+        mutex lock;
+        std::condition_variable wake;
+        std::condition_variable flushed;
+        std::thread thread;
+        vector<Ring*> rings;
+        FILE* file = stdout;
+        bool stopping = false;
+        uint64_t flushWanted = 0;
+        uint64_t flushDone = 0;
+
+        time_t stampSecond = 0;
+        string stamp;
+        string batch;
+
+        ~Writer()
+        {
+            {
+                unique_lock<mutex> guard(lock);
+                if (!thread.joinable())
+                    return;
+                stopping = true;
+            }
+            wake.notify_one();
+            thread.join();
+            for (auto ring : rings)
+                delete ring;
+        }
+
+        //! register a new producer's ring, starting the writer if need be
+        void add(Ring* ring)
+        {
+            unique_lock<mutex> guard(lock);
+            rings.push_back(ring);
+            if (!thread.joinable())
+                thread = std::thread(&Writer::run, this);
+        }
+
+        //! "DEBUG: Mon Oct 19 12:34:56 2026 ", recomputed once per second
+        const string& prefix()
+        {
+            time_t now = time(NULL);
+            if (now != stampSecond || stamp.empty())
+            {
+                string ts = ctime(&now);
+                ts.resize(ts.size() - 1);
+                stamp = "DEBUG: " + ts + " ";
+                stampSecond = now;
+            }
+            return stamp;
+        }
+
+        //! called with lock held
+        void drainAll()
+        {
+            batch.clear();
+            const string& pre = prefix();
+            for (size_t i = 0; i < rings.size(); )
+            {
+                Ring* ring = rings[i];
+                bool retired = ring->retired.load(std::memory_order_acquire);
+                ring->drain(batch, pre);
+
+                uint64_t dropped = ring->dropped.load(std::memory_order_relaxed);
+                if (dropped != ring->reported)
+                {
+                    char buf[96];
+                    snprintf(buf, sizeof(buf), "AsyncLog: dropped %llu messages (queue full)",
+                        (unsigned long long) (dropped - ring->reported));
+                    batch += pre + buf + "\n";
+                    ring->reported = dropped;
+                }
+
+                if (retired)
+                {
+                    delete ring;
+                    rings[i] = rings.back();
+                    rings.pop_back();
+                }
+                else
+                    i++;
+            }
+
+            if (!batch.empty() && file)
+            {
+                fwrite(batch.data(), 1, batch.size(), file);
+                fflush(file);
+            }
+        }
+
+        void run()
+        {
+            unique_lock<mutex> guard(lock);
+            while (true)
+            {
+                wake.wait_for(guard, std::chrono::milliseconds(DRAIN_MS),
+                    [this] { return stopping || flushWanted > flushDone; });
+
+                uint64_t wanted = flushWanted;
+                drainAll();
+                flushDone = wanted;
+                flushed.notify_all();
+
+                if (stopping)
+                    break;
+            }
+        }
+    };
+
+    Writer writer;
+
+    //! retires the calling thread's ring when the thread exits
+    struct Producer
+    {
+        Ring* ring = nullptr;
+
+        ~Producer()
+        {
+            if (ring)
+                ring->retired.store(true, std::memory_order_release);
+        }
+    };
+
+    thread_local Producer producer;
+}
+
+void Identify::AsyncLog::write(const char* fmt, va_list args)
+{
+    if (!producer.ring)
+    {
+        producer.ring = new Ring();
+        writer.add(producer.ring);
+    }
+
+    char scratch[SCRATCH_LEN];
+    va_list copy;
+    va_copy(copy, args);
+    int len = vsnprintf(scratch, sizeof(scratch), fmt, copy);
+    va_end(copy);
+    if (len < 0)
+        return;
+
+    if (len < (int) sizeof(scratch))
+    {
+        producer.ring->push(scratch, (uint32_t) len);
+        return;
+    }
+
+    // rare: long messages such as log_spectrum dumps
+    thread_local string big;
+    big.resize(len + 1);
+    vsnprintf(&big[0], big.size(), fmt, args);
+    producer.ring->push(big.data(), (uint32_t) (len < MAX_RECORD ? len : MAX_RECORD));
+}
+
+void Identify::AsyncLog::flush()
+{
+    unique_lock<mutex> guard(writer.lock);
+    if (!writer.thread.joinable())
+        return;
+    uint64_t wanted = ++writer.flushWanted;
+    writer.wake.notify_one();
+    writer.flushed.wait(guard, [wanted] { return writer.flushDone >= wanted; });
+}
+
+void Identify::AsyncLog::setFile(FILE* f)
+{
+    flush();
+    unique_lock<mutex> guard(writer.lock);
+    writer.file = f;
+}
@@ -0,0 +1,36 @@
+#ifndef IDENTIFY_ASYNC_LOG_H
+#define IDENTIFY_ASYNC_LOG_H
+
+#include <stdarg.h>
+#include <stdio.h>
+
+namespace Identify
+{
+    /*! @brief Background writer behind Util::log.
+
+        Each logging thread formats its message into a private lock-free
+        single-producer/single-consumer ring; one writer thread drains all
+        rings every few milliseconds, prefixes a cached timestamp and writes
+        the batch with a single fwrite.  A producer never blocks: if its ring
+        is full the message is dropped and counted, and the writer reports the
+        count in the log.
+
+        Because records are timestamped when drained, times are accurate to
+        the drain interval, and lines from different threads are only ordered
+        within each thread.
+    */
+    class AsyncLog
+    {
+        public:
+            //! queue one formatted line (starts the writer on first use)
+            static void write(const char* fmt, va_list args);
+
+            //! drain and flush everything queued so far, then write to f
+            static void setFile(FILE* f);
+
+            //! block until every line queued so far has been written
+            static void flush();
+    };
+}
+
+#endif
@@ -0,0 +1,93 @@
+#include "AxisCache.h"
+
+#include "Util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+using std::list;
+using std::mutex;
+using std::string;
+using std::vector;
+using std::lock_guard;
+
+Identify::AxisCache::AxisCache(size_t capacity) 
+    : capacity(capacity),
+      hitCount(0),
+      missCount(0)
+{
+}
+
+uint64_t Identify::AxisCache::hash(const vector<float>& wavenumbers)
+{
+    uint64_t h = 14695981039346656037ULL;
+    const unsigned char* p = (const unsigned char*) wavenumbers.data();
+    for (size_t i = 0; i < wavenumbers.size() * sizeof(float); i++)
+    {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+bool Identify::AxisCache::isId(const string& id)
+{
+    if (id.size() != 16)
+        return false;
+    for (char c : id)
+        if (!(('0' <= c && c <= '9') || ('a' <= c && c <= 'f')))
+            return false;
+    return true;
+}
+
+string Identify::AxisCache::add(const vector<float>& wavenumbers)
+{
+    uint64_t id = hash(wavenumbers);
+    string idStr = Util::sprintf("%016llx", (unsigned long long) id);
+
+    lock_guard<mutex> guard(lock);
+    for (auto it = axes.begin(); it != axes.end(); ++it)
+    {
+        if (it->id == id && it->wavenumbers == wavenumbers)
+        {
+            axes.splice(axes.begin(), axes, it);
+            hitCount.fetch_add(1, std::memory_order_relaxed);
+            return idStr;
+        }
+    }
+    missCount.fetch_add(1, std::memory_order_relaxed);
+
+    LOG_DEBUG("AxisCache: adding axis %s (%lu pixels)", idStr.c_str(), wavenumbers.size());
+    Axis axis;
+    axis.id = id;
+    axis.wavenumbers = wavenumbers;
+    axes.push_front(axis);
+    if (axes.size() > capacity)
+        axes.pop_back();
+    return idStr;
+}
+
+bool Identify::AxisCache::lookup(const string& idStr, vector<float>& wavenumbers)
+{
+    char* end = nullptr;
+    uint64_t id = strtoull(idStr.c_str(), &end, 16);
+    if (idStr.empty() || *end != 0)
+    {
+        missCount.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    lock_guard<mutex> guard(lock);
+    for (auto it = axes.begin(); it != axes.end(); ++it)
+    {
+        if (it->id == id)
+        {
+            axes.splice(axes.begin(), axes, it);
+            wavenumbers.assign(it->wavenumbers.begin(), it->wavenumbers.end());
+            hitCount.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    missCount.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
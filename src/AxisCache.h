@@ -0,0 +1,61 @@
+#ifndef IDENTIFY_AXIS_CACHE_H
+#define IDENTIFY_AXIS_CACHE_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <list>
+
+#include <stdint.h>
+
+namespace Identify
+{
+    /**
+        A small, thread-safe, least-recently-used table of the wavenumber axes
+        seen in streamed requests.
+
+        Consecutive requests from one spectrometer carry byte-identical axes, so
+        the server returns a hash of each axis as "axis_id" and clients may send
+        that back in place of the full "wavenumbers" array.  Any precomputation
+        which depends only on the axis belongs in Axis, so that it too is paid
+        once per spectrometer rather than once per request.
+    */
+    class AxisCache
+    {
+        public:
+            AxisCache(size_t capacity = 16);
+
+            //! remember an axis (or refresh it), returning its id
+            std::string add(const std::vector<float>& wavenumbers);
+
+            //! copy a previously-seen axis into 'wavenumbers'
+            //! @returns false if the id is unknown (or has been evicted)
+            bool lookup(const std::string& id, std::vector<float>& wavenumbers);
+
+            //! whether this could be an id add() returned (16 lowercase hex digits)
+            static bool isId(const std::string& id);
+
+            //! FNV-1a over the axis' float representation
+            static uint64_t hash(const std::vector<float>& wavenumbers);
+
+            //! axes (or ids) we already knew, vs. new axes and unknown ids
+            uint64_t hits() const { return hitCount.load(std::memory_order_relaxed); }
+            uint64_t misses() const { return missCount.load(std::memory_order_relaxed); }
+
+        private:
+            struct Axis
+            {
+                uint64_t id;
+                std::vector<float> wavenumbers;
+            };
+
+            size_t capacity;
+            std::list<Axis> axes; //!< most-recently used first
+            std::mutex lock;
+            std::atomic<uint64_t> hitCount;
+            std::atomic<uint64_t> missCount;
+    };
+}
+
+#endif
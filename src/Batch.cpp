@@ -0,0 +1,418 @@
+#include "Batch.h"
+#include "MappedFile.h"
+
+#include "Util.h"
+
+#include <atomic>
+#include <memory>
+
+#include <stdio.h>
+
+using std::mutex;
+using std::string;
+using std::vector;
+using std::shared_ptr;
+using std::unique_lock;
+
+#define WINDOW_PER_JOB  4  // files in flight per worker
+#define SPECTRA_PER_JOB 64 // containers larger than this are split across workers
+
+Identify::Batch::Batch(const Library& library, BatchWriter& writer, unsigned jobs, bool unordered) :
+    library(library),
+    writer(writer),
+    jobs(jobs),
+    unordered(unordered),
+    reused(0),
+    rescored(0),
+    processed(0)
+{
+}
+
+//! identify entries [first, last) of a container, returning their formatted results
+//! @param record (optional) keep each entry's peaks and matches here, for the store
+//! @param failed set if any entry couldn't be identified (so the record is incomplete)
+string Identify::Batch::identify(const SpectrumContainer& container, size_t first, size_t last, double loadUS, ResultStore::Record* record, bool& failed) const
+{
+    string output;
+    vector<Match> matches;
+    for (size_t i = first; i < last; i++)
+    {
+        const SpectrumContainer::Entry& entry = container.entries[i];
+        Timing timing;
+        Timing* t = writer.wantsTiming() ? &timing : nullptr;
+        if (t)
+            t->read = loadUS;
+
+        try
+        {
+            int pixels = entry.intensities ? container.pixels : 0;
+            if (record)
+            {
+                ResultStore::Entry& kept = record->entries[i];
+                kept.name = entry.name;
+                kept.peaks = library.samplePeaks(container.wavenumbers, entry.intensities, pixels, t);
+                library.identify(kept.peaks, writer.maxResults(), matches, nullptr, t);
+                for (auto& match : matches)
+                    kept.matches.push_back(std::make_pair((uint32_t) library.indexOf(*match.compound), match.score));
+            }
+            else
+                library.identify(container.wavenumbers, entry.intensities, pixels, writer.maxResults(), matches, nullptr, t);
+            output += writer.format(entry.name, container.path(i), matches, t);
+        }
+        catch (std::exception& e)
+        {
+            output += unidentified(entry.name, container.path(i), e.what());
+            failed = true;
+        }
+        LOG_DEBUG("");
+    }
+    return output;
+}
+
+//! the result for an input (or spectrum) which couldn't be identified: it's
+//! reported unmatched, so it still takes its place in the output
+string Identify::Batch::unidentified(const string& name, const string& path, const char* what) const
+{
+    fprintf(stderr, "unable to identify %s: %s\n", path.c_str(), what);
+    Timing timing;
+    return writer.format(name, path, vector<Match>(), writer.wantsTiming() ? &timing : nullptr);
+}
+
+//! the next input, from the prefetcher (if any) or straight from the source,
+//! then from the stream (if any)
+bool Identify::Batch::next(PathSource& source, Input& input)
+{
+    input.file = nullptr;
+    input.block = CSVStream::Block(); // (so the stream can reuse its buffer)
+
+    if (!drained)
+    {
+        if (!prefetcher)
+        {
+            if (source.next(input.pathname))
+                return true;
+        }
+        else if ((input.file = prefetcher->next()) != nullptr)
+        {
+            input.pathname = input.file->pathname;
+            return true;
+        }
+        drained = true;
+    }
+
+    if (!stream || !stream->next(input.block))
+        return false;
+    input.pathname = input.block.name;
+    return true;
+}
+
+/**
+    Answer an input from the store, if it has a record of this version of the
+    file (the same size, and mtime or contents).
+
+    @returns false if the file must be processed
+*/
+bool Identify::Batch::reuse(size_t seq, const string& pathname, Prefetcher::File* file, const ResultStore::Key& key)
+{
+    Timing lookup;
+    lookup.start();
+
+    ResultStore::Record record;
+    if (!store->find(pathname, record) || record.key.size != key.size)
+        return false;
+
+    bool touched = record.key.mtime != key.mtime;
+    if (touched)
+    {
+        // perhaps copied or touched, but not changed
+        uint64_t hash;
+        if (file && file->complete)
+            hash = Util::hash(file->begin(), file->length);
+        else
+        {
+            MappedFile f(pathname);
+            if (!f.valid())
+                return false;
+            hash = Util::hash(f.begin(), f.size());
+        }
+        if (hash != record.key.hash)
+            return false;
+        record.key.mtime = key.mtime;
+    }
+    if (file)
+        prefetcher->release(file);
+
+    // the same library's matches stand (if there are enough of them)
+    int maxResults = writer.maxResults();
+    bool rescore = record.generation != library.generation() || (int) record.results < std::min(maxResults, 255);
+    for (size_t i = 0; i < record.entries.size() && !rescore; i++)
+        for (auto& match : record.entries[i].matches)
+            rescore = rescore || match.first >= library.size();
+    lookup.lap(lookup.read);
+
+    string output;
+    vector<Match> matches;
+    double lookupUS = record.entries.size() ? lookup.read / record.entries.size() : 0;
+    for (size_t i = 0; i < record.entries.size(); i++)
+    {
+        ResultStore::Entry& entry = record.entries[i];
+        Timing timing;
+        Timing* t = writer.wantsTiming() ? &timing : nullptr;
+        if (t)
+            t->read = lookupUS;
+
+        if (rescore)
+        {
+            library.identify(entry.peaks, maxResults, matches, nullptr, t);
+            entry.matches.clear();
+            for (auto& match : matches)
+                entry.matches.push_back(std::make_pair((uint32_t) library.indexOf(*match.compound), match.score));
+        }
+        else
+        {
+            matches.clear();
+            for (size_t j = 0; j < entry.matches.size() && (int) j < maxResults; j++)
+                matches.push_back(Match { &library.compound(entry.matches[j].first), entry.matches[j].second });
+        }
+        output += writer.format(entry.name, SpectrumContainer::path(pathname, record.multi, i), matches, t);
+    }
+
+    if (rescore)
+    {
+        record.generation = library.generation();
+        record.results = (uint32_t) std::min(maxResults, 255);
+        rescored++;
+    }
+    else
+        reused++;
+    if (rescore || touched)
+        store->put(pathname, record);
+
+    complete(seq, output);
+    return true;
+}
+
+//! load one input file (or parse its prefetched or streamed contents), and
+//! identify (or farm out) every spectrum in it
+//!
+//! Whatever happens, complete(seq) must be called exactly once, or printing
+//! (and so the whole batch) would stall at this input.
+void Identify::Batch::work(size_t seq, const Input& input)
+{
+    try
+    {
+        process(seq, input);
+    }
+    catch (std::exception& e)
+    {
+        // (nothing was completed: identify catches its own, so a fanned-out
+        // container's chunks always complete it)
+        string output = unidentified(input.pathname, input.pathname, e.what());
+        complete(seq, output);
+    }
+}
+
+void Identify::Batch::process(size_t seq, const Input& input)
+{
+    const string& pathname = input.pathname;
+    Prefetcher::File* file = input.file;
+
+    ResultStore::Key key;
+    bool keyed = store && !input.block.buffer && ResultStore::stat(pathname, key);
+    if (keyed && reuse(seq, pathname, file, key))
+        return;
+
+    Timing load;
+    load.start();
+    shared_ptr<SpectrumContainer> container;
+    if (input.block.buffer)
+    {
+        // the stream's buffer is kept until the last spectrum is identified
+        shared_ptr<const string> buffer = input.block.buffer;
+        container.reset(new SpectrumContainer(pathname, input.block.begin, input.block.end),
+            [buffer](SpectrumContainer* c) { delete c; });
+    }
+    else if (file && file->complete)
+    {
+        // the buffer goes back to the pool once the last spectrum is identified
+        Prefetcher* reader = prefetcher;
+        container.reset(new SpectrumContainer(pathname, file->begin(), file->end()),
+            [reader, file](SpectrumContainer* c) { delete c; reader->release(file); });
+    }
+    else
+    {
+        if (file)
+            prefetcher->release(file); // unreadable, or too large to prefetch
+        container.reset(new SpectrumContainer(pathname));
+    }
+    load.lap(load.read);
+
+    // what the store will keep, once every spectrum is identified
+    shared_ptr<ResultStore::Record> record;
+    if (keyed)
+    {
+        record.reset(new ResultStore::Record);
+        record->key = key;
+        record->key.hash = container->hash();
+        record->generation = library.generation();
+        record->results = (uint32_t) std::min(writer.maxResults(), 255);
+        record->multi = container->multi;
+        record->entries.resize(container->size());
+    }
+
+    size_t n = container->size();
+    double loadUS = n ? load.read / n : 0; // (amortized over the spectra sharing it)
+    if (!pool || n <= SPECTRA_PER_JOB)
+    {
+        bool failed = false;
+        string output = identify(*container, 0, n, loadUS, record.get(), failed);
+        if (record && !failed) // (don't keep a partial record)
+        {
+            store->put(pathname, *record);
+            processed++;
+        }
+        complete(seq, output);
+        return;
+    }
+
+    // one chunk per job; the last to finish passes them all on, in order
+    struct Parts
+    {
+        vector<string> outputs;
+        std::atomic<size_t> remaining;
+        std::atomic<bool> failed;
+    };
+    size_t chunks = (n + SPECTRA_PER_JOB - 1) / SPECTRA_PER_JOB;
+    shared_ptr<Parts> parts(new Parts);
+    parts->outputs.resize(chunks);
+    parts->remaining = chunks;
+    parts->failed = false;
+
+    auto chunk = [this, seq, pathname, container, record, parts, n, loadUS](size_t k)
+    {
+        size_t first = k * SPECTRA_PER_JOB;
+        size_t last = std::min(n, first + SPECTRA_PER_JOB);
+        bool failed = false;
+        parts->outputs[k] = identify(*container, first, last, loadUS, record.get(), failed);
+        if (failed)
+            parts->failed = true;
+        if (--parts->remaining == 0)
+        {
+            if (record && !parts->failed)
+            {
+                store->put(pathname, *record);
+                processed++;
+            }
+            string output;
+            for (auto& part : parts->outputs)
+                output += part;
+            complete(seq, output);
+        }
+    };
+    for (size_t k = 1; k < chunks; k++)
+        pool->submit([chunk, k] { chunk(k); });
+    chunk(0);
+}
+
+//! hand over one input's results, printing whatever is now ready
+void Identify::Batch::complete(size_t seq, string& output)
+{
+    if (!pool)
+    {
+        writer.write(output);
+        return;
+    }
+
+    unique_lock<mutex> guard(lock);
+    if (unordered)
+    {
+        writer.write(output);
+        printed++;
+    }
+    else
+    {
+        size_t window = slots.size();
+        Slot& slot = slots[seq % window];
+        slot.output.swap(output);
+        slot.done = true;
+
+        // whoever completes the oldest file prints everything that's
+        // ready behind it
+        while (slots[printed % window].done)
+        {
+            Slot& ready = slots[printed % window];
+            writer.write(ready.output);
+            ready.output.clear();
+            ready.done = false;
+            printed++;
+        }
+    }
+    finished.notify_one();
+}
+
+int Identify::Batch::run(PathSource& source)
+{
+    // process each spectrum on the cmd-line
+    LOG_DEBUG("------------------------------------------");
+    LOG_DEBUG("Processing input files");
+    LOG_DEBUG("------------------------------------------");
+
+    writer.begin();
+    std::unique_ptr<WorkerPool> workers;
+    size_t window = 0;
+    if (jobs != 1)
+    {
+        workers.reset(new WorkerPool(jobs));
+        window = workers->size() * WINDOW_PER_JOB;
+        slots.resize(window);
+    }
+
+    // enough buffers for every file in flight, and the one waiting for a slot
+    std::unique_ptr<Prefetcher> reader;
+    if (prefetchDepth)
+        reader.reset(new Prefetcher(source, prefetchDepth, prefetchBytes, (unsigned) window + 1, prefetchThreads));
+    prefetcher = reader.get();
+
+    Input input;
+    drained = false;
+    if (!workers)
+    {
+        while (next(source, input))
+            work(submitted++, input);
+        finish();
+        return 0;
+    }
+
+    pool = workers.get();
+    while (next(source, input))
+    {
+        size_t seq;
+        {
+            unique_lock<mutex> guard(lock);
+            finished.wait(guard, [this, window] { return submitted - printed < window; });
+            seq = submitted++;
+        }
+        workers->submit([this, seq, input] { work(seq, input); });
+    }
+    workers->wait();
+    pool = nullptr;
+    finish();
+    return 0;
+}
+
+void Identify::Batch::finish()
+{
+    writer.flush();
+    if (prefetcher)
+    {
+        fprintf(stderr, "%s\n", prefetcher->report().c_str());
+        prefetcher = nullptr;
+    }
+    if (store)
+    {
+        store->flush();
+        fprintf(stderr, "results store: %lu reused, %lu re-scored, %lu processed (%lu files in %s)\n",
+            (unsigned long) reused, (unsigned long) rescored, (unsigned long) processed,
+            (unsigned long) store->size(), store->path().c_str());
+    }
+}
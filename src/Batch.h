@@ -0,0 +1,127 @@
+#ifndef IDENTIFY_BATCH_H
+#define IDENTIFY_BATCH_H
+
+#include "Library.h"
+#include "PathSource.h"
+#include "BatchWriter.h"
+#include "SpectrumContainer.h"
+#include "CSVStream.h"
+#include "Prefetcher.h"
+#include "ResultStore.h"
+#include "WorkerPool.h"
+
+#include <condition_variable>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Identify
+{
+    /**
+        Batch mode: identify every file from a PathSource, and write each
+        one's results through a BatchWriter.
+
+        With jobs > 1, files are parsed and identified on a WorkerPool.  At
+        most 'window' files are in flight at once (pulled from the source,
+        but not yet printed), so memory stays bounded however many files
+        there are.  Results are printed in the source's order, or as each
+        file finishes if 'unordered' (in which case a slow file doesn't hold
+        back those behind it).  Workers also format their own results, so
+        only appending them to the output is serialized.
+
+        Each input may hold many spectra (@see SpectrumContainer): it is
+        loaded once, and if it holds more than SPECTRA_PER_JOB they are split
+        into chunks across the pool, and their results gathered back into the
+        input's slot in order.
+
+        With setPrefetch, inputs are read ahead into memory by a Prefetcher,
+        so the workers parse them without blocking on I/O.
+
+        With setStore, files unchanged since a previous run are answered from
+        its ResultStore (re-scoring their cached peaks if the library has
+        changed) without being read, and the results for everything else are
+        added to it.
+
+        With setStream, each CSV block read from a CSVStream (after the
+        source's files) is identified as though it were a file, straight from
+        the buffer it was read into.
+    */
+    class Batch
+    {
+        public:
+            //! @param jobs worker threads (1 = process inline, 0 = one per hardware thread)
+            Batch(const Library& library, BatchWriter& writer, unsigned jobs = 1, bool unordered = false);
+
+            //! read up to 'depth' files ahead of the workers (0 = let each worker read its own)
+            //! @param bufferBytes largest file to prefetch (larger ones are mapped as usual)
+            //! @param threads read with a thread pool, even where io_uring is available
+            void setPrefetch(unsigned depth, size_t bufferBytes, bool threads = false)
+            {
+                prefetchDepth = depth;
+                prefetchBytes = bufferBytes;
+                prefetchThreads = threads;
+            }
+
+            //! reuse and record results in this store (which must outlive the run)
+            void setStore(ResultStore* s) { store = s; }
+
+            //! after the source's files, identify each CSV block from this stream
+            void setStream(CSVStream* s) { stream = s; }
+
+            //! @returns process exit code
+            int run(PathSource& source);
+
+        private:
+            //! one in-flight file, by sequence number modulo the window
+            struct Slot
+            {
+                std::string output;
+                bool done = false;
+            };
+
+            //! one file (or block) to identify
+            struct Input
+            {
+                std::string pathname;
+                Prefetcher::File* file = nullptr; //!< prefetched contents
+                CSVStream::Block block;           //!< (or read from the stream)
+            };
+
+            bool next(PathSource& source, Input& input);
+            void work(size_t seq, const Input& input);
+            void process(size_t seq, const Input& input);
+            bool reuse(size_t seq, const std::string& pathname, Prefetcher::File* file, const ResultStore::Key& key);
+            std::string identify(const SpectrumContainer& container, size_t first, size_t last, double loadUS, ResultStore::Record* record, bool& failed) const;
+            std::string unidentified(const std::string& name, const std::string& path, const char* what) const;
+            void complete(size_t seq, std::string& output);
+            void finish();
+
+            const Library& library;
+            BatchWriter& writer;
+            unsigned jobs;
+            bool unordered;
+            WorkerPool* pool = nullptr; //!< while running with jobs > 1
+
+            unsigned prefetchDepth = 0;
+            size_t prefetchBytes = 0;
+            bool prefetchThreads = false;
+            Prefetcher* prefetcher = nullptr; //!< while running, if prefetching
+
+            CSVStream* stream = nullptr;
+            bool drained = false; //!< the source has no more files
+
+            ResultStore* store = nullptr;
+            std::atomic<size_t> reused;    //!< files answered from the store as they were
+            std::atomic<size_t> rescored;  //!< ...or by re-scoring their cached peaks
+            std::atomic<size_t> processed; //!< files read and recorded in the store
+
+            std::vector<Slot> slots;
+            size_t submitted = 0; //!< files handed to the pool
+            size_t printed = 0;   //!< files whose results have been printed
+            std::mutex lock;
+            std::condition_variable finished;
+    };
+}
+
+#endif
@@ -0,0 +1,251 @@
+#include "BatchWriter.h"
+#include "ResponseWriter.h"
+
+#include "Util.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+
+using std::string;
+using std::vector;
+
+#define WRITE_CHUNK (1024 * 1024) // bytes buffered between writes
+
+namespace
+{
+    // (BatchWriter::write hides ::write, and Windows spells it _write)
+    long writeFd(int fd, const char* data, size_t len)
+    {
+#ifdef _WIN32
+        return _write(fd, data, (unsigned) len);
+#else
+        return ::write(fd, data, len);
+#endif
+    }
+
+    bool isTerminal(int fd)
+    {
+#ifdef _WIN32
+        return _isatty(fd) != 0;
+#else
+        return isatty(fd) != 0;
+#endif
+    }
+
+    //! a CSV field, quoted if it must be
+    void appendCSV(string& out, const string& field)
+    {
+        if (field.find_first_of(",\"\r\n") == string::npos)
+        {
+            out += field;
+            return;
+        }
+        out += '"';
+        for (char c : field)
+        {
+            if (c == '"')
+                out += '"';
+            out += c;
+        }
+        out += '"';
+    }
+
+    template<typename T> void appendRaw(string& out, T value)
+    {
+        char bytes[sizeof(T)];
+        memcpy(bytes, &value, sizeof(T));
+        out.append(bytes, sizeof(T));
+    }
+
+    //! u16 length, then the bytes (truncated to 64 KB)
+    void appendBytes(string& out, const string& s)
+    {
+        uint16_t len = (uint16_t) std::min(s.size(), (size_t) 0xffff);
+        appendRaw(out, len);
+        out.append(s.data(), len);
+    }
+}
+
+Identify::BatchWriter::BatchWriter(const Library& library, Format format, int maxResults, bool timings, int fd) :
+    library(library),
+    fmt(format),
+    results(format == TEXT ? 1 : std::max(1, maxResults)),
+    timings(timings && format != TEXT),
+    fd(fd)
+{
+    interactive = isTerminal(fd);
+    buffer.reserve(WRITE_CHUNK + 64 * 1024);
+}
+
+Identify::BatchWriter::~BatchWriter()
+{
+    flush();
+}
+
+bool Identify::BatchWriter::parseFormat(const string& name, Format& format)
+{
+         if (name == "text"  ) format = TEXT;
+    else if (name == "ndjson") format = NDJSON;
+    else if (name == "csv"   ) format = CSV;
+    else if (name == "bin"   ) format = BIN;
+    else
+        return false;
+    return true;
+}
+
+void Identify::BatchWriter::begin()
+{
+    if (fmt == CSV)
+    {
+        buffer += "Sample,Path";
+        for (int i = 1; i <= results; i++)
+            buffer += Util::sprintf(",Name%d,Score%d", i, i);
+        if (timings)
+            buffer += ",Load,Boxcar,Peaks,Scan,Output";
+        buffer += "\n";
+    }
+    else if (fmt == BIN)
+    {
+        buffer += "RIDB";
+        appendRaw<uint32_t>(buffer, 1);
+        appendRaw<uint32_t>(buffer, results);
+        appendRaw<uint32_t>(buffer, timings ? 1 : 0);
+        appendRaw<uint32_t>(buffer, (uint32_t) library.size());
+        for (size_t i = 0; i < library.size(); i++)
+            appendBytes(buffer, library.compound(i).name);
+    }
+}
+
+string Identify::BatchWriter::format(const string& name, const string& path, const vector<Match>& matches, Timing* timing) const
+{
+    string out;
+    if (timing)
+        timing->start();
+    switch (fmt)
+    {
+        case TEXT:   formatText  (out, name, matches);               break;
+        case NDJSON: formatJSON  (out, name, path, matches, timing); break;
+        case CSV:    formatCSV   (out, name, path, matches, timing); break;
+        case BIN:    formatBinary(out, name, path, matches, timing); break;
+    }
+    return out;
+}
+
+void Identify::BatchWriter::formatText(string& out, const string& name, const vector<Match>& matches) const
+{
+    if (matches.size() > 0)
+        out = Util::sprintf("sample %s: matched library %s with score %.2f\n", name.c_str(), matches[0].compound->name.c_str(), matches[0].score);
+    else
+        out = Util::sprintf("sample %s: NO MATCH\n", name.c_str());
+}
+
+void Identify::BatchWriter::formatJSON(string& out, const string& name, const string& path, const vector<Match>& matches, Timing* timing) const
+{
+    out += "{ \"Sample\": \"";
+    out += Util::jsonEscape(name);
+    out += "\", \"Path\": \"";
+    out += Util::jsonEscape(path);
+    out += "\", \"MatchResult\": [ ";
+    for (size_t i = 0; i < matches.size(); i++)
+    {
+        if (i)
+            out += ", ";
+        out += "{ \"Name\": \"";
+        out += matches[i].compound->jsonName;
+        out += "\", \"Score\": ";
+        ResponseWriter::appendScore(out, matches[i].score);
+        out += " }";
+    }
+    out += matches.empty() ? "]" : " ]";
+    if (timing)
+    {
+        timing->lap(timing->output);
+        out += Util::sprintf(", \"Timing\": { \"Load\": %.1f, \"Boxcar\": %.1f, \"Peaks\": %.1f, \"Scan\": %.1f, "
+            "\"Output\": %.1f, \"SamplePeaks\": %d, \"CompoundsScored\": %d }",
+            timing->read, timing->boxcar, timing->peaks, timing->scan, timing->output, timing->samplePeaks, timing->compoundsScored);
+    }
+    out += " }\n";
+}
+
+void Identify::BatchWriter::formatCSV(string& out, const string& name, const string& path, const vector<Match>& matches, Timing* timing) const
+{
+    appendCSV(out, name);
+    out += ',';
+    appendCSV(out, path);
+    for (int i = 0; i < results; i++)
+    {
+        out += ',';
+        if (i < (int) matches.size())
+        {
+            appendCSV(out, matches[i].compound->name);
+            out += ',';
+            ResponseWriter::appendScore(out, matches[i].score);
+        }
+        else
+            out += ',';
+    }
+    if (timing)
+    {
+        timing->lap(timing->output);
+        out += Util::sprintf(",%.1f,%.1f,%.1f,%.1f,%.1f", timing->read, timing->boxcar, timing->peaks, timing->scan, timing->output);
+    }
+    out += '\n';
+}
+
+void Identify::BatchWriter::formatBinary(string& out, const string& name, const string& path, const vector<Match>& matches, Timing* timing) const
+{
+    appendBytes(out, name);
+    appendBytes(out, path);
+    uint8_t count = (uint8_t) std::min(matches.size(), (size_t) std::min(results, 255));
+    appendRaw(out, count);
+    for (unsigned i = 0; i < count; i++)
+    {
+        appendRaw<uint32_t>(out, (uint32_t) library.indexOf(*matches[i].compound));
+        appendRaw<float>(out, matches[i].score);
+    }
+    if (timing)
+    {
+        timing->lap(timing->output);
+        appendRaw<float>(out, (float) timing->read);
+        appendRaw<float>(out, (float) timing->boxcar);
+        appendRaw<float>(out, (float) timing->peaks);
+        appendRaw<float>(out, (float) timing->scan);
+        appendRaw<float>(out, (float) timing->output);
+    }
+}
+
+void Identify::BatchWriter::write(const string& output)
+{
+    buffer += output;
+    if (interactive || buffer.size() >= WRITE_CHUNK)
+        flush();
+}
+
+void Identify::BatchWriter::flush()
+{
+    const char* data = buffer.data();
+    size_t len = buffer.size();
+    while (len > 0)
+    {
+        long n = writeFd(fd, data, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "BatchWriter: write failed (errno %d)\n", errno);
+            break;
+        }
+        data += n;
+        len -= n;
+    }
+    buffer.clear(); // keeps capacity
+}
@@ -0,0 +1,93 @@
+#ifndef IDENTIFY_BATCH_WRITER_H
+#define IDENTIFY_BATCH_WRITER_H
+
+#include "Library.h"
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+namespace Identify
+{
+    /**
+        Formats batch results, and writes them in large chunks.
+
+        format() renders one sample's results, and is called on the worker
+        that identified it, so formatting parallelizes; write() appends the
+        result to a buffer which goes to the OS one write(2) at a time, every
+        WRITE_CHUNK bytes (or per record, if the output is a terminal).
+
+        Formats:
+
+        - text:   "sample NAME: matched library NAME with score 85.70" (the
+                  original output; best match only, no timings)
+        - ndjson: { "Sample": ..., "Path": ..., "MatchResult": [ { "Name": ...,
+                  "Score": ... }, ... ] [, "Timing": { ... }] }
+        - csv:    a header row, then Sample,Path,Name1,Score1,...NameK,ScoreK
+                  [,Load,Boxcar,Peaks,Scan,Output] per sample
+        - bin:    native-endian (little-endian on x86 and ARM) records:
+
+                  header: "RIDB", u32 version (1), u32 maxResults, u32 flags
+                          (1 = timings), u32 compounds, then each compound
+                          name as u16 length + bytes
+                  record: u16 length + sample name, u16 length + path,
+                          u8 matches, then per match u32 compound index and
+                          f32 score, then (with timings) f32 microseconds
+                          load, boxcar, peaks, scan, output
+
+        Timings (in microseconds) are per-stage: "Load" is reading and parsing
+        the file (shared equally between the spectra of a container); the
+        others are as in streaming (@see Timing).
+    */
+    class BatchWriter
+    {
+        public:
+            enum Format { TEXT, NDJSON, CSV, BIN };
+
+            //! @param fd where to write (default stdout)
+            BatchWriter(const Library& library, Format format = TEXT, int maxResults = 1, bool timings = false, int fd = 1);
+            ~BatchWriter();
+
+            //! @returns false for an unknown format name
+            static bool parseFormat(const std::string& name, Format& format);
+
+            int maxResults() const { return results; }
+            bool wantsTiming() const { return timings; }
+
+            //! the output for one sample (thread-safe)
+            //! @param name the sample's name
+            //! @param path its file (or "file#i", within a container)
+            //! @param timing (optional) stages so far; the output stage is added here
+            std::string format(const std::string& name, const std::string& path, const std::vector<Match>& matches, Timing* timing) const;
+
+            //! anything which precedes the first record (a CSV header, say)
+            void begin();
+
+            //! queue formatted output (not thread-safe; Batch serializes calls)
+            void write(const std::string& output);
+
+            //! write everything buffered so far
+            void flush();
+
+            //! write each record as it's queued (as for a terminal), e.g. when
+            //! results are awaited as each file arrives
+            void setInteractive(bool b) { interactive = b; }
+
+        private:
+            void formatText(std::string& out, const std::string& name, const std::vector<Match>& matches) const;
+            void formatJSON(std::string& out, const std::string& name, const std::string& path, const std::vector<Match>& matches, Timing* timing) const;
+            void formatCSV(std::string& out, const std::string& name, const std::string& path, const std::vector<Match>& matches, Timing* timing) const;
+            void formatBinary(std::string& out, const std::string& name, const std::string& path, const std::vector<Match>& matches, Timing* timing) const;
+
+            const Library& library;
+            Format fmt;
+            int results;
+            bool timings;
+            int fd;
+            bool interactive; //!< fd is a terminal, so don't hold output back
+            std::string buffer;
+    };
+}
+
+#endif
@@ -0,0 +1,277 @@
+#include "Bench.h"
+#include "StreamRequestJSON.h"
+#include "ResponseWriter.h"
+
+#include "Util.h"
+
+#ifdef _WIN32
+#include <io.h>
+#define open _open
+#define close _close
+#define NULL_DEVICE "NUL"
+#else
+#include <unistd.h>
+#include <sys/resource.h>
+#define NULL_DEVICE "/dev/null"
+#endif
+
+#include <algorithm>
+#include <streambuf>
+#include <istream>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <new>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+
+using std::list;
+using std::string;
+using std::vector;
+using std::atomic;
+using std::shared_ptr;
+
+////////////////////////////////////////////////////////////////////////////////
+// Allocation counting
+////////////////////////////////////////////////////////////////////////////////
+
+// The replacement operator new only counts while a pass is being measured,
+// so outside --bench it costs one relaxed load per allocation.
+static atomic<bool> countingAllocations(false);
+static atomic<uint64_t> allocations(0);
+
+void* operator new(size_t size)
+{
+    if (countingAllocations.load(std::memory_order_relaxed))
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+
+////////////////////////////////////////////////////////////////////////////////
+// Passes
+////////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    //! an istream over an existing buffer, without copying it
+    struct MemoryBuffer : public std::streambuf
+    {
+        MemoryBuffer(const string& s)
+        {
+            char* p = const_cast<char*>(s.data());
+            setg(p, p, p + s.size());
+        }
+    };
+
+    //! latencies and counts for one way of running the samples
+    struct Pass
+    {
+        const char* label;
+        vector<double> us;
+        double seconds = 0;
+        uint64_t allocations = 0;
+
+        Pass(const char* label) : label(label) {}
+
+        double percentile(double q) const { return us.empty() ? 0 : us[std::min(us.size() - 1, (size_t) (q * us.size()))]; }
+        double perSecond() const { return seconds > 0 ? us.size() / seconds : 0; }
+        double allocsPerRequest() const { return us.empty() ? 0 : 1.0 * allocations / us.size(); }
+
+        //! @param requests expected, so recording latencies doesn't allocate
+        void start(size_t requests)
+        {
+            us.clear();
+            us.reserve(requests);
+            allocations = ::allocations.load();
+            countingAllocations = true;
+            began = Clock::now();
+        }
+
+        void stop()
+        {
+            seconds = std::chrono::duration<double>(Clock::now() - began).count();
+            countingAllocations = false;
+            allocations = ::allocations.load() - allocations;
+            std::sort(us.begin(), us.end());
+        }
+
+        void print() const
+        {
+            printf("%-10s %7lu requests in %7.3f s: %9.1f req/s, p50 %7.1f us, p90 %7.1f us, p99 %7.1f us, max %7.1f us, %5.1f allocs/req\n",
+                label, us.size(), seconds, perSecond(), percentile(0.5), percentile(0.9), percentile(0.99),
+                us.empty() ? 0 : us.back(), allocsPerRequest());
+        }
+
+        string toJSON() const
+        {
+            return Util::sprintf("{ \"Requests\": %lu, \"Seconds\": %.3f, \"RequestsPerSec\": %.1f, \"P50\": %.1f, \"P90\": %.1f, \"P99\": %.1f, \"Max\": %.1f, \"AllocsPerRequest\": %.2f }",
+                us.size(), seconds, perSecond(), percentile(0.5), percentile(0.9), percentile(0.99),
+                us.empty() ? 0 : us.back(), allocsPerRequest());
+        }
+
+        typedef std::chrono::steady_clock Clock;
+        Clock::time_point began;
+    };
+
+    double since(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    //! high-water resident set size, in KB (0 if unknown)
+    long peakRSS()
+    {
+        long kb = 0;
+#ifndef _WIN32
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) == 0)
+            kb = usage.ru_maxrss;
+#ifdef __APPLE__
+        kb /= 1024; // bytes on MacOS, KB elsewhere
+#endif
+#endif
+        return kb;
+    }
+
+    //! current resident set size, in KB (the peak where that's unavailable;
+    //! on Linux ru_maxrss also survives fork+exec, e.g. from a Python parent)
+    long currentRSS()
+    {
+#ifdef __linux__
+        long pages = 0, resident = 0;
+        FILE* f = fopen("/proc/self/statm", "r");
+        if (f)
+        {
+            int n = fscanf(f, "%ld %ld", &pages, &resident);
+            fclose(f);
+            if (n == 2)
+                return resident * (sysconf(_SC_PAGESIZE) / 1024);
+        }
+#endif
+        return peakRSS();
+    }
+
+    //! Library::identify on already-loaded spectra
+    void identifyPass(const Identify::Library& library, const vector<Identify::Spectrum>& samples, int iterations, Pass& pass)
+    {
+        vector<Identify::Match> matches;
+        matches.reserve(20);
+
+        pass.start(iterations * samples.size());
+        for (int i = 0; i < iterations; i++)
+            for (auto& sample : samples)
+            {
+                auto start = std::chrono::steady_clock::now();
+                library.identify(sample, 20, matches);
+                pass.us.push_back(since(start));
+            }
+        pass.stop();
+    }
+
+    //! the --streaming loop (inline requests), reading NDJSON from memory and
+    //! writing responses to /dev/null
+    void streamingPass(const Identify::Library& library, const string& ndjson, size_t count, int iterations, Identify::ResponseWriter& writer, Pass& pass)
+    {
+        shared_ptr<Identify::StreamRequestJSON> request;
+
+        pass.start(iterations * count);
+        for (int i = 0; i < iterations; i++)
+        {
+            MemoryBuffer buffer(ndjson);
+            std::istream is(&buffer);
+            while (is.peek() != EOF)
+            {
+                auto start = std::chrono::steady_clock::now();
+                if (request)
+                    request->reload(is);
+                else
+                    request.reset(new Identify::StreamRequestJSON(is));
+                if (!request->valid)
+                    break;
+                writer.respond(library, *request);
+                writer.flush();
+                pass.us.push_back(since(start));
+            }
+        }
+        pass.stop();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Bench
+////////////////////////////////////////////////////////////////////////////////
+
+int Identify::Bench::run(const string& libraryPath, const list<const char*>& files, int iterations)
+{
+    long baseRSS = currentRSS();
+    auto loadStart = std::chrono::steady_clock::now();
+    Library library(libraryPath);
+    double loadSeconds = since(loadStart) / 1e6;
+    long loadRSS = currentRSS() - baseRSS;
+
+    vector<Spectrum> samples;
+    string ndjson;
+    for (auto& pathname : files)
+    {
+        struct stat s;
+        if (stat(pathname, &s) == 0 && (s.st_mode & S_IFDIR))
+            continue;
+
+        Spectrum spectrum(pathname);
+        if (spectrum.pixels < 1)
+        {
+            fprintf(stderr, "skipping %s (no spectrum)\n", pathname);
+            continue;
+        }
+        samples.push_back(spectrum);
+        ndjson += StreamRequestJSON::toJSON(spectrum);
+    }
+    if (samples.empty())
+    {
+        fprintf(stderr, "no samples to benchmark\n");
+        return 1;
+    }
+
+    int fd = open(NULL_DEVICE, O_WRONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "unable to open %s\n", NULL_DEVICE);
+        return 1;
+    }
+
+    int warmup = std::max(1, iterations / 10);
+    printf("bench: %lu samples x %d iterations (after %d warmup) against %lu compounds\n",
+        samples.size(), iterations, warmup, library.size());
+
+    Pass direct("identify");
+    Pass streaming("streaming");
+    {
+        ResponseWriter writer(fd);
+        identifyPass(library, samples, warmup, direct);
+        identifyPass(library, samples, iterations, direct);
+        streamingPass(library, ndjson, samples.size(), warmup, writer, streaming);
+        streamingPass(library, ndjson, samples.size(), iterations, writer, streaming);
+    }
+    close(fd);
+
+    direct.print();
+    streaming.print();
+    printf("library loaded in %.3f s (%lu KB, RSS +%ld KB), peak RSS %ld KB\n",
+        loadSeconds, library.bytes() / 1024, loadRSS, peakRSS());
+
+    printf("{ \"Bench\": { \"Samples\": %lu, \"Iterations\": %d, \"Warmup\": %d, \"Compounds\": %lu, \"LoadSeconds\": %.3f, \"LibraryKB\": %lu, \"LoadRSSKB\": %ld, \"Identify\": %s, \"Streaming\": %s, \"PeakRSSKB\": %ld } }\n",
+        samples.size(), iterations, warmup, library.size(), loadSeconds, library.bytes() / 1024, loadRSS,
+        direct.toJSON().c_str(), streaming.toJSON().c_str(), peakRSS());
+    return 0;
+}
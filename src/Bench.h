@@ -0,0 +1,32 @@
+#ifndef IDENTIFY_BENCH_H
+#define IDENTIFY_BENCH_H
+
+#include "Library.h"
+
+#include <list>
+
+namespace Identify
+{
+    /**
+        identify --bench: a reproducible measurement of identification speed.
+
+        The library is loaded (and its load time and memory recorded), the
+        samples are loaded once, then identified 'iterations' times each
+        (after a warmup pass) in two ways: calling Library::identify directly,
+        and through the --streaming code path (parse, identify, format, write
+        to /dev/null) from an in-memory NDJSON buffer, so that the protocol's
+        own overhead shows up as the difference between the two.
+
+        Reports requests/sec, latency percentiles, heap allocations per
+        request (operator new is counted while a pass runs) and peak RSS,
+        first as a table and then as a single line of JSON.
+    */
+    class Bench
+    {
+        public:
+            //! @returns process exit code
+            static int run(const std::string& libraryPath, const std::list<const char*>& files, int iterations);
+    };
+}
+
+#endif
@@ -1,9 +1,10 @@
 #include "CSVParser.h"
+#include "MappedFile.h"
 
 #include "Util.h"
 
-#include <fstream>
-#include <iostream>
+#include <string.h>
+#include <ctype.h>
 
 using std::vector;
 using std::string;
@@ -11,7 +12,16 @@ using std::string;
 Identify::CSVParser::CSVParser(const string& pathname)
 {
     this->pathname = pathname;
-    valid = parse(pathname);    
+
+    MappedFile f(pathname);
+    valid = f.valid() ? parse(f.begin(), f.end()) 
+                      : true; // as before: an unreadable file is an empty spectrum
+}
+
+Identify::CSVParser::CSVParser(const string& pathname, const char* begin, const char* end)
+{
+    this->pathname = pathname;
+    valid = parse(begin, end);
 }
 
 //! @todo could clean-up pathname a little (remove .csv etc)
@@ -27,61 +37,150 @@ bool Identify::CSVParser::isValid() const
     return valid;
 }
 
-bool Identify::CSVParser::isNum(const string& line) const
+bool Identify::CSVParser::Token::equalsLower(const char* s) const
+{
+    size_t len = strlen(s);
+    if (size() != len)
+        return false;
+    for (size_t i = 0; i < len; i++)
+        if (tolower((unsigned char) begin[i]) != s[i])
+            return false;
+    return true;
+}
+
+bool Identify::CSVParser::Token::containsLower(const char* s) const
+{
+    size_t len = strlen(s);
+    for (const char* p = begin; p + len <= end; p++)
+    {
+        size_t i = 0;
+        while (i < len && tolower((unsigned char) p[i]) == s[i])
+            i++;
+        if (i == len)
+            return true;
+    }
+    return false;
+}
+
+bool Identify::CSVParser::isNum(const Token& line) const
 {
     if (line.size() == 0)
         return false;
-    char c = line[0];
+    char c = line.begin[0];
     return ('0' <= c && c <= '9') || c == '-';
 }
 
-void Identify::CSVParser::readHeader(const vector<string>& tok)
+//! fields as Util::split(line, ",") would return them (a trailing comma adds no field)
+void Identify::CSVParser::split(const Token& line)
+{
+    tok.clear();
+    const char* prev = line.begin;
+    const char* pos;
+    do
+    {
+        pos = static_cast<const char*>(memchr(prev, ',', line.end - prev));
+        if (!pos)
+            pos = line.end;
+        tok.push_back(Token { prev, pos });
+        prev = pos + 1;
+    }
+    while (pos < line.end && prev < line.end);
+}
+
+void Identify::CSVParser::readHeader()
 {
     for (unsigned i = 0; i < tok.size(); i++)
     {
-        string s(Util::toLower(tok[i]));
-        if (s == "wavenumber")
+        const Token& s = tok[i];
+        if (s.equalsLower("wavenumber"))
             colWavenumber = i;
-        else if (Util::match(s, "processed|spectrum|spectra|intensity")) // any but "raw"
+        else if (s.containsLower("processed") || s.containsLower("spectrum") || 
+                 s.containsLower("spectra")   || s.containsLower("intensity")) // any but "raw"
+        {
             colIntensity = i;
+            if (s.containsLower("processed"))
+                colIntensities.push_back(i);
+        }
     }
+
+    if (isMulti())
+    {
+        columns.resize(colIntensities.size());
+        for (auto& column : columns)
+            column.reserve(wavenumbers.capacity()); // (reserved for every line)
+    }
+    else
+        colIntensities.clear();
 }
 
-void Identify::CSVParser::readValues(const vector<string>& tok)
+void Identify::CSVParser::readValues()
 {
     int len = (int)tok.size();
-    if ((len < colWavenumber + 1) ||
-        (len < colIntensity  + 1))
+    if (len < colWavenumber + 1)
+        return;
+
+    if (isMulti())
+    {
+        // (a short row leaves its missing measurements at zero, so every
+        // column keeps a value per wavenumber)
+        wavenumbers.push_back(Util::parseFloat(tok[colWavenumber].begin, tok[colWavenumber].end));
+        for (size_t i = 0; i < colIntensities.size(); i++)
+        {
+            int col = colIntensities[i];
+            columns[i].push_back(col < len ? Util::parseFloat(tok[col].begin, tok[col].end) : 0);
+        }
         return;
+    }
 
-    float wavenumber = (float) atof(tok[colWavenumber].c_str());
-    float intensity  = (float) atof(tok[colIntensity ].c_str());
+    if (len < colIntensity + 1)
+        return;
 
+    float wavenumber = Util::parseFloat(tok[colWavenumber].begin, tok[colWavenumber].end);
     wavenumbers.push_back(wavenumber);
+
+    float intensity  = Util::parseFloat(tok[colIntensity ].begin, tok[colIntensity ].end);
     intensities.push_back(intensity);
 }
 
-bool Identify::CSVParser::parse(const string& pathname)
+bool Identify::CSVParser::parse(const char* begin, const char* end)
 {
-    std::ifstream f;
-    f.open(pathname, std::ios_base::in);
+    if (begin == end)
+        return true; // empty (or unreadable, with no mapping at all)
+
+    // at most one value per line
+    size_t lines = 1;
+    for (const char* p = begin; (p = static_cast<const char*>(memchr(p, '\n', end - p))); p++)
+        lines++;
+    wavenumbers.reserve(lines);
+    intensities.reserve(lines);
+    tok.reserve(16);
 
     enum States { READING_METADATA, READING_DATA, READING_HEADER };
     States state = READING_METADATA;
 
-    string line;
-    while (std::getline(f, line))
+    const char* next = begin;
+    while (next < end)
     {
-        Util::trim(line);
+        const char* eol = static_cast<const char*>(memchr(next, '\n', end - next));
+        if (!eol)
+            eol = end;
+        Token line { next, eol };
+        next = eol + 1;
+
+        // trim
+        while (line.begin < line.end && isspace((unsigned char) line.begin[0]))
+            line.begin++;
+        while (line.end > line.begin && isspace((unsigned char) line.end[-1]))
+            line.end--;
 
         // some files have "CSV blanks" (lines of nothing but commas)
-        if (Util::match(line, "^,+$"))
-            line = "";
-
-        vector<string> tok = Util::split(line, ",");
-        Util::trim(tok);
+        const char* c = line.begin;
+        while (c < line.end && *c == ',')
+            c++;
+        if (c == line.end)
+            line.end = line.begin;
 
-        // Util::log("read[%-20s]: %s", state.c_str(), line.c_str());
+        split(line);
 
         if (state == READING_METADATA)
         {
@@ -91,7 +190,7 @@ bool Identify::CSVParser::parse(const string& pathname)
                 // or we're already past it.  Unfortunately, this probably means
                 // we don't know what the field ordering is, so assume defaults.
                 state = READING_DATA;
-                readValues(tok);
+                readValues();
             }
             else if (!line.size())
             {
@@ -103,9 +202,15 @@ bool Identify::CSVParser::parse(const string& pathname)
                 // parse metadata -- the only field we're using right now is "Label"
                 if (tok.size() > 1)
                 {
-                    if (Util::toLower(tok[0]) == "label")
+                    if (tok[0].equalsLower("label"))
                     {
-                        label = tok[1];
+                        label.assign(tok[1].begin, tok[1].end);
+                        if (tok.size() > 2)
+                        {
+                            labels.clear();
+                            for (size_t i = 1; i < tok.size(); i++)
+                                labels.push_back(string(tok[i].begin, tok[i].end));
+                        }
                     }
                 }
             }
@@ -119,17 +224,17 @@ bool Identify::CSVParser::parse(const string& pathname)
             else if (isNum(line))
             {
                 state = READING_DATA;
-                readValues(tok);
+                readValues();
             }
             else
             {
-                readHeader(tok);
+                readHeader();
                 state = READING_DATA;
             }
         }
         else if (state == READING_DATA)
         {
-            readValues(tok);
+            readValues();
         }
         else
         {
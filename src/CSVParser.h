@@ -6,25 +6,61 @@
 
 namespace Identify
 {
+    /**
+        Reads (wavenumber, intensity) pairs, and the "Label", from a CSV file
+        as saved by ENLIGHTEN (metadata, blank, header, data) or a bare CSV of
+        numbers.
+
+        The file is memory-mapped and scanned in place: lines and fields are
+        pointer/length Tokens into the mapping, and numbers are converted by
+        Util::parseFloat, so nothing is allocated per line.
+
+        An ENLIGHTEN multi-column export (more than one "Processed" column,
+        sharing one Wavenumber column) holds one measurement per column: its
+        intensities are read into 'columns' instead, and the values of the
+        Label row name them in order.
+    */
     class CSVParser
     {
         public:
             // methods
             CSVParser(const std::string& pathname);
+
+            //! parse a file already in memory (e.g. a MappedFile)
+            CSVParser(const std::string& pathname, const char* begin, const char* end);
+
             std::string getName() const;
             bool isValid() const;
 
+            //! whether this was a multi-column export (@see columns)
+            bool isMulti() const { return colIntensities.size() > 1; }
+
             // attributes
             std::vector<float> wavenumbers;
             std::vector<float> intensities;
 
+            std::vector<std::vector<float>> columns; //!< per measurement, if isMulti()
+            std::vector<std::string> labels;         //!< Label row values, in order
+
         private:
+            //! a field (or line) within the mapped file
+            struct Token
+            {
+                const char* begin;
+                const char* end;
+
+                size_t size() const { return end - begin; }
+                bool equalsLower(const char* s) const;  //!< case-insensitive match of a lowercase literal
+                bool containsLower(const char* s) const; //!< case-insensitive search for a lowercase literal
+            };
+
             // methods
-            bool parse(const std::string& pathname);
+            bool parse(const char* begin, const char* end);
+            void split(const Token& line);
 
-            inline bool isNum(const std::string& line) const;
-            void readHeader(const std::vector<std::string>& tok);
-            void readValues(const std::vector<std::string>& tok);
+            inline bool isNum(const Token& line) const;
+            void readHeader();
+            void readValues();
 
             // attributes
             bool valid = false;
@@ -32,6 +68,9 @@ namespace Identify
             std::string label;
             int colWavenumber = 0; // initial defaults (dynamically
             int colIntensity  = 1; // overwritten if header row found)
+            std::vector<int> colIntensities; //!< "Processed" columns, if several
+
+            std::vector<Token> tok; //!< fields of the current line (reused)
     };
 }
 
@@ -0,0 +1,139 @@
+#include "CSVStream.h"
+
+#include "Util.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <stdio.h>
+
+using std::string;
+using std::shared_ptr;
+
+#define READ_CHUNK (64 * 1024) // bytes read at once
+
+Identify::CSVStream::CSVStream(int fd) :
+    fd(fd),
+    buffer(new string)
+{
+    buffer->reserve(2 * READ_CHUNK);
+}
+
+//! as CSVParser sees a line: blank (or nothing but commas), data, or anything else
+Identify::CSVStream::Kind Identify::CSVStream::classify(const char* begin, const char* end) const
+{
+    while (begin < end && isspace((unsigned char) *begin))
+        begin++;
+    const char* c = begin;
+    while (c < end && (*c == ',' || isspace((unsigned char) *c)))
+        c++;
+    if (c == end)
+        return BLANK;
+
+    return (('0' <= *begin && *begin <= '9') || *begin == '-') ? NUMERIC : TEXT;
+}
+
+bool Identify::CSVStream::next(Block& block)
+{
+    while (true)
+    {
+        const char* data = buffer->data();
+        size_t size = buffer->size();
+        while (scanned < size)
+        {
+            const char* line = data + scanned;
+            const char* eol = static_cast<const char*>(memchr(line, '\n', size - scanned));
+            if (!eol)
+            {
+                if (!eof)
+                    break; // (wait for the rest of the line)
+                eol = data + size;
+            }
+            size_t following = std::min((size_t) (eol - data) + 1, size);
+
+            Kind kind = classify(line, eol);
+            if (state == READING_DATA)
+            {
+                if (kind == BLANK)
+                    return emit(block, scanned, following);
+                if (kind == TEXT)
+                    return emit(block, scanned, scanned); // (the next block's metadata)
+            }
+            else if (kind == BLANK && state == READING_METADATA && start == scanned)
+                start = following; // (blank lines between blocks)
+            else if (kind == NUMERIC)
+                state = READING_DATA;
+            else if (kind == BLANK)
+                state = READING_HEADER;
+            scanned = following;
+        }
+
+        if (eof)
+        {
+            if (state == READING_DATA)
+                return emit(block, size, size);
+            if (start < size)
+                LOG_INFO("CSVStream: ignoring %lu bytes with no data at the end of the stream", (unsigned long) (size - start));
+            start = scanned = size;
+            return false;
+        }
+        fill();
+    }
+}
+
+//! return [start, end) as the next block, and carry on from 'resume'
+bool Identify::CSVStream::emit(Block& block, size_t end, size_t resume)
+{
+    block.name = "stdin:" + std::to_string(++count);
+    block.buffer = buffer;
+    block.begin = buffer->data() + start;
+    block.end = buffer->data() + end;
+
+    start = scanned = resume;
+    state = READING_METADATA;
+    return true;
+}
+
+//! read more of the stream onto the end of the buffer (setting eof at the end)
+bool Identify::CSVStream::fill()
+{
+    size_t pending = buffer->size() - start;
+    if (buffer.use_count() > 1)
+    {
+        // blocks still in use point into this buffer, so start another with
+        // whatever of the current block has been read
+        shared_ptr<string> fresh(new string);
+        fresh->reserve(std::max((size_t) 2 * READ_CHUNK, pending + READ_CHUNK));
+        fresh->assign(buffer->data() + start, pending);
+        buffer = fresh;
+    }
+    else if (start)
+        buffer->erase(0, start);
+    scanned -= start;
+    start = 0;
+
+    long n;
+    do
+    {
+        buffer->resize(pending + READ_CHUNK);
+#ifdef _WIN32
+        n = _read(fd, &(*buffer)[pending], READ_CHUNK);
+#else
+        n = ::read(fd, &(*buffer)[pending], READ_CHUNK);
+#endif
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0)
+        fprintf(stderr, "unable to read CSV spectra from stdin: %s\n", strerror(errno));
+    buffer->resize(pending + std::max(n, 0L));
+    eof = n <= 0;
+    return !eof;
+}
@@ -0,0 +1,67 @@
+#ifndef IDENTIFY_CSV_STREAM_H
+#define IDENTIFY_CSV_STREAM_H
+
+#include <memory>
+#include <string>
+
+namespace Identify
+{
+    /**
+        Splits a stream of CSV spectra (such as a pipeline writes to our stdin)
+        into one block per spectrum, in the ENLIGHTEN export layout:
+
+          metadata rows, a blank line, a header row, then data rows
+
+        A block ends at a blank line after its data, or where metadata starts
+        again (a non-numeric row after data), or at the end of the stream.
+        Either part before the data is optional, as it is in a file.
+
+        Blocks are returned in place in the buffer they were read into, for
+        CSVParser to parse as it would a mapped file: a block is only copied
+        if it straddles a read, and then only the part read so far.  Each
+        block keeps its buffer alive, so it may outlive later calls to next.
+
+        A block is returned as soon as its last line is read, so a producer
+        that ends each spectrum with a blank line gets its result straight
+        back, rather than when the next one starts.
+    */
+    class CSVStream
+    {
+        public:
+            //! one spectrum's rows
+            struct Block
+            {
+                std::string name;                          //!< "stdin:1", "stdin:2"...
+                std::shared_ptr<const std::string> buffer; //!< (what begin and end point into)
+                const char* begin = nullptr;
+                const char* end = nullptr;
+            };
+
+            //! @param fd read from here (not closed)
+            CSVStream(int fd = 0);
+
+            //! @returns false at the end of the stream (or on a read error)
+            bool next(Block& block);
+
+            size_t blocks() const { return count; }
+
+        private:
+            enum Kind { BLANK, NUMERIC, TEXT };
+            enum States { READING_METADATA, READING_HEADER, READING_DATA };
+
+            Kind classify(const char* begin, const char* end) const;
+            bool emit(Block& block, size_t end, size_t resume);
+            bool fill();
+
+            int fd;
+            bool eof = false;
+            size_t count = 0;
+
+            std::shared_ptr<std::string> buffer;
+            size_t start = 0;   //!< where the current block begins in the buffer
+            size_t scanned = 0; //!< where the first line not yet classified begins
+            States state = READING_METADATA;
+    };
+}
+
+#endif
@@ -1,5 +1,13 @@
+#include <algorithm>
+#include <fstream>
 #include <list>
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
 #include "Library.h"
 #include "Spectrum.h"
 #include "Util.h"
@@ -14,6 +22,8 @@
 
 #define MAX_WAVENUMBER_OFFSET    10 // allow sample peaks to shift this much from library
 
+#define COMPOUND_BLOCK           16 // compounds scored between checks of the clock
+
 using std::map;
 using std::list;
 using std::string;
@@ -30,24 +40,111 @@ const string unknownCompound("UNKNOWN");
 
 Identify::Library::Library(const string& dir)
 {
-    vector<string> filenames = Util::readDir(dir);
-    for (auto& filename : filenames)
+    struct stat s;
+    if (stat(dir.c_str(), &s) == 0 && !(s.st_mode & S_IFDIR))
+        loadPeaks(dir);
+    else
     {
-        if (!Util::endsWith(filename, ".csv"))
-            continue;
+        vector<string> filenames = Util::readDir(dir);
+        for (auto& filename : filenames)
+        {
+            if (!Util::endsWith(filename, ".csv"))
+                continue;
+
+            Identify::Spectrum spectrum(dir + "/" + filename);
+            add(spectrum);
+        }
+    }
 
-        Identify::Spectrum spectrum(dir + "/" + filename);
-        add(spectrum);
+    // everything scores depend on: the compounds, and how peaks are matched
+    int offset = MAX_WAVENUMBER_OFFSET;
+    gen = Util::hash(&offset, sizeof(offset));
+    bool first = true;
+    for (auto& compound : compounds)
+    {
+        gen = Util::hash(compound.name.c_str(), compound.name.size() + 1, gen);
+        gen = Util::hash(compound.peakWavenumbers.data(), compound.peakWavenumbers.size() * sizeof(float), gen);
+        for (float lp : compound.peakWavenumbers)
+        {
+            peakLo = first ? lp : std::min(peakLo, lp);
+            peakHi = first ? lp : std::max(peakHi, lp);
+            first = false;
+        }
     }
 }
 
+//! a hash of the sample peak-finding parameters (which cached sample peaks depend on)
+uint64_t Identify::Library::sampleParameters()
+{
+    const int params[] = { BOXCAR_SAMPLE, MIN_RAMP_PIXELS_SAMPLE, MIN_PEAK_HEIGHT_SAMPLE };
+    return Util::hash(params, sizeof(params));
+}
+
+//! compounds are kept sorted by name; the first spectrum loaded for a name wins
 void Identify::Library::add(const Spectrum& spectrum)
 {
     auto peakWavenumbers = findPeakWavenumbers(spectrum, BOXCAR_LIBRARY, MIN_RAMP_PIXELS_LIBRARY, MIN_PEAK_HEIGHT_LIBRARY);
     if (peakWavenumbers.size() == 0)
         return;
 
-    libraryPeakWavenumbers.insert(std::make_pair(spectrum.name, peakWavenumbers));
+    auto it = std::lower_bound(compounds.begin(), compounds.end(), spectrum.name, 
+        [](const LibrarySpectrum& c, const string& name) { return c.name < name; });
+    if (it != compounds.end() && it->name == spectrum.name)
+        return;
+
+    compounds.insert(it, LibrarySpectrum(spectrum.name, peakWavenumbers));
+}
+
+/**
+    Load a compiled library: one compound per line, its name followed by its
+    peak wavenumbers, comma-separated ("Acetone,787.4,1710.2,2921.9").  Blank
+    lines and lines starting with '#' are skipped.  As with CSV directories,
+    the first compound loaded for a name wins.
+
+    This skips reading and peak-finding whole spectra, so is how very large
+    (e.g. synthetic) libraries are loaded.
+*/
+void Identify::Library::loadPeaks(const string& pathname)
+{
+    std::ifstream is(pathname);
+    if (!is)
+    {
+        fprintf(stderr, "unable to read library %s\n", pathname.c_str());
+        return;
+    }
+
+    string line;
+    vector<float> peakWavenumbers;
+    while (std::getline(is, line))
+    {
+        size_t comma = line.find(',');
+        if (line.empty() || line[0] == '#' || comma == string::npos || comma == 0)
+            continue;
+
+        peakWavenumbers.clear();
+        const char* p = line.c_str() + comma;
+        while (*p == ',')
+        {
+            char* end = nullptr;
+            float wavenumber = strtof(p + 1, &end);
+            if (end == p + 1)
+                break;
+            peakWavenumbers.push_back(wavenumber);
+            p = end;
+        }
+        if (peakWavenumbers.empty())
+            continue;
+
+        std::sort(peakWavenumbers.begin(), peakWavenumbers.end());
+        compounds.push_back(LibrarySpectrum(line.substr(0, comma), peakWavenumbers));
+    }
+
+    // sorting once beats add()'s sorted insert when there are 10^5+ compounds
+    std::stable_sort(compounds.begin(), compounds.end(),
+        [](const LibrarySpectrum& a, const LibrarySpectrum& b) { return a.name < b.name; });
+    compounds.erase(std::unique(compounds.begin(), compounds.end(),
+        [](const LibrarySpectrum& a, const LibrarySpectrum& b) { return a.name == b.name; }), compounds.end());
+    compounds.shrink_to_fit();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -58,53 +155,209 @@ void Identify::Library::add(const Spectrum& spectrum)
 
 /**
     Compare the passed 'sample' spectrum against the library spectra.  If any 
-    match, return the index of the best-matching library compound and populate
+    match, return the name of the best-matching library compound and populate
     'score' with an approximate confidence rating.
 
-    @param score (output) confidence score (higher is better, range 0 .. 1)
-    @returns negative on failure (no match), else best matching compound index
-             (range 0 .. (n-1))
+    @param score (output) confidence score (higher is better, range 0 .. 100)
+    @returns name of the best matching compound, or empty on failure (no match)
 */
 string Identify::Library::identify(const Spectrum& sample, float& score) const
 {
-    score = -1;
+    vector<Match> matches;
+    identify(sample, 1, matches);
+    if (matches.empty())
+    {
+        score = 0;
+        return "";
+    }
+
+    score = matches[0].score;
+    return matches[0].compound->name;
+}
+
+size_t Identify::Library::bytes() const
+{
+    size_t total = compounds.capacity() * sizeof(LibrarySpectrum);
+    for (auto& compound : compounds)
+        total += compound.name.capacity() + compound.jsonName.capacity() + compound.peakWavenumbers.capacity() * sizeof(float);
+    return total;
+}
+
+/**
+    Score the passed 'sample' spectrum against every library compound.
+
+    @param maxResults (input) how many of the best matches to return
+    @param matches (output) compounds with non-zero score, best first (ties
+           broken by name)
+*/
+bool Identify::Library::identify(const Spectrum& sample, int maxResults, vector<Match>& matches, const Budget* budget, Timing* timing) const
+{
+    return identify(sample.wavenumbers.data(), sample.intensities.data(), sample.pixels, maxResults, matches, budget, timing);
+}
+
+bool Identify::Library::identify(const float* wavenumbers, const float* intensities, int pixels, int maxResults, vector<Match>& matches, const Budget* budget, Timing* timing) const
+{
+    matches.clear();
+    return identify(samplePeaks(wavenumbers, intensities, pixels, timing), maxResults, matches, budget, timing);
+}
+
+//! findPeakWavenumbers with the sample parameters, split so the stages can be timed
+vector<float> Identify::Library::samplePeaks(const float* wavenumbers, const float* intensities, int pixels, Timing* timing) const
+{
+    if (timing)
+        timing->start();
+    auto smoothed = boxcar(intensities, pixels, BOXCAR_SAMPLE);
+    if (timing)
+        timing->lap(timing->boxcar);
+    auto samplePeakWavenumbers = findPeaks(wavenumbers, smoothed.data(), pixels, MIN_RAMP_PIXELS_SAMPLE, MIN_PEAK_HEIGHT_SAMPLE);
+    if (timing)
+    {
+        timing->lap(timing->peaks);
+        timing->samplePeaks = (int) samplePeakWavenumbers.size();
+    }
+    return samplePeakWavenumbers;
+}
 
-    auto samplePeakWavenumbers = findPeakWavenumbers(sample, BOXCAR_SAMPLE, MIN_RAMP_PIXELS_SAMPLE, MIN_PEAK_HEIGHT_SAMPLE);
+bool Identify::Library::identify(const vector<float>& samplePeakWavenumbers, int maxResults, vector<Match>& matches, const Budget* budget, Timing* timing) const
+{
+    matches.clear();
+    bool complete = true;
+    if (timing)
+        timing->start();
 
     // no match possible
     if (samplePeakWavenumbers.size() < 1)
     {
-        Util::log("identify: no sample peaks found");
-        return "";
+        LOG_DEBUG("identify: no sample peaks found");
+        return true;
     }
 
-    Util::log("identify: sample peak wavenumbers: %s", Util::join(samplePeakWavenumbers, ", ").c_str());
+    LOG_DEBUG("identify: sample peak wavenumbers: %s", Util::join(samplePeakWavenumbers, ", ").c_str());
+
+    // score the most promising compounds first, so that a deadline leaves us
+    // with the best results so far, and so we can stop once no remaining
+    // compound could make the cut
+    vector<std::pair<float, int>> ranked;
+    rankCompounds(samplePeakWavenumbers, ranked);
 
-    Util::log("identify: Computing fitness of each library compound");
-    float bestScore = 0;
-    string bestCompound;
-    for (auto it = libraryPeakWavenumbers.begin(); it != libraryPeakWavenumbers.end(); ++it)
+    auto better = [](const Match& a, const Match& b) 
+    { 
+        // compounds are sorted by name, so ties are broken alphabetically
+        return a.score > b.score || (a.score == b.score && a.compound < b.compound); 
+    };
+
+    LOG_DEBUG("identify: Computing fitness of each library compound");
+    for (int i = 0; i < (int) ranked.size(); i++)
     {
-        const string& name = it->first;
+        if (budget && budget->cancel && budget->cancel->load(std::memory_order_relaxed))
+        {
+            LOG_DEBUG("identify: cancelled");
+            complete = false;
+            break;
+        }
+
+        if (budget && budget->hasDeadline && i % COMPOUND_BLOCK == 0 && i > 0 && 
+            std::chrono::steady_clock::now() >= budget->deadline)
+        {
+            LOG_DEBUG("identify: deadline reached after %d of %lu compounds", i, ranked.size());
+            complete = false;
+            break;
+        }
 
-        Util::log("identify: computing fitness of %s...", name.c_str());
-        float thisScore = checkFit(samplePeakWavenumbers, it->second);
+        float bound = ranked[i].first;
+        if (bound == 0)
+            break; // nothing further can score
 
-        Util::log("identify: %s thisScore = %.2f", name.c_str(), thisScore);
+        // everything from here on is bounded below the worst result we'd keep
+        if (maxResults >= 0 && (int) matches.size() >= maxResults)
+            if (maxResults == 0 || bound < matches.back().score)
+                break;
+
+        const LibrarySpectrum& compound = compounds[ranked[i].second];
+        LOG_TRACE("identify: computing fitness of %s...", compound.name.c_str());
+        float thisScore = checkFit(samplePeakWavenumbers, compound.peakWavenumbers);
+        if (timing)
+            timing->compoundsScored++;
+
+        LOG_TRACE("identify: %s thisScore = %.2f", compound.name.c_str(), thisScore);
         if (thisScore == 0)
             continue;
 
-        if (bestScore < thisScore)
+        // keep matches sorted, and no longer than needed
+        Match match = { &compound, thisScore };
+        matches.insert(std::upper_bound(matches.begin(), matches.end(), match, better), match);
+        if (maxResults >= 0 && (int) matches.size() > maxResults)
+            matches.pop_back();
+    }
+
+    if (timing)
+        timing->lap(timing->scan);
+
+    if (matches.size())
+        LOG_DEBUG("identify: returning compound %s (score %.2f)", matches[0].compound->name.c_str(), matches[0].score);
+    return complete;
+}
+
+/**
+    Cheaply bound the score each compound could achieve against the sample,
+    and rank the compounds by it (best first).
+
+    A library peak can only contribute to checkFit if some sample peak lies 
+    within MAX_WAVENUMBER_OFFSET of it, so bucketing the sample peaks into bins 
+    of that width and counting library peaks with an occupied neighbouring bin 
+    gives an upper bound on the score, in time linear in the number of peaks.
+
+    The bins span the library's peaks (and MAX_WAVENUMBER_OFFSET either side),
+    not the sample's: sample peaks beyond them can't match anything, and
+    needn't cost memory (a stray peak at 1e12 cm-1 would otherwise ask for
+    10^11 bins).
+
+    @param ranked (output) (bound, compound index) pairs, highest bound first
+*/
+void Identify::Library::rankCompounds(const vector<float>& samplePeaks, vector<std::pair<float, int>>& ranked) const
+{
+    ranked.clear();
+    ranked.reserve(compounds.size());
+
+    // pad by one bin either side so neighbour lookups never go out of range
+    float lo = peakLo - MAX_WAVENUMBER_OFFSET;
+    float hi = peakHi + MAX_WAVENUMBER_OFFSET;
+    int bins = (int)((hi - lo) / MAX_WAVENUMBER_OFFSET) + 3;
+    vector<unsigned char> occupied(bins, 0);
+    for (float sp : samplePeaks)
+        if (sp >= lo && sp <= hi) // (false for NaN too)
+            occupied[(int)((sp - lo) / MAX_WAVENUMBER_OFFSET)] = 1;
+
+    for (int i = 0; i < (int) compounds.size(); i++)
+    {
+        const vector<float>& libraryPeaks = compounds[i].peakWavenumbers;
+
+        // checkFit's own early-outs
+        int possible = 0;
+        if (libraryPeaks.size() > 0 && samplePeaks.size() >= libraryPeaks.size())
         {
-            bestScore = thisScore;
-            bestCompound = name;
-            Util::log("identify: best score now %.2f (best compound %s)", bestScore, bestCompound.c_str());
+            for (float lp : libraryPeaks)
+            {
+                int bin = (int) floorf((lp - lo) / MAX_WAVENUMBER_OFFSET);
+                for (int b = bin - 1; b <= bin + 1; b++)
+                {
+                    if (b >= 0 && b < bins && occupied[b])
+                    {
+                        possible++;
+                        break;
+                    }
+                }
+            }
         }
+
+        // (a little slack covers float rounding in checkFit's running total)
+        float bound = possible ? 100.0f * possible / libraryPeaks.size() + 0.01f : 0;
+        ranked.push_back(std::make_pair(bound, i));
     }
 
-    score = bestScore;
-    Util::log("identify: returning compound %s (score %.2f)", bestCompound.c_str(), score);
-    return bestCompound;    
+    // highest bound first; equal bounds stay in name order
+    std::stable_sort(ranked.begin(), ranked.end(), 
+        [](const std::pair<float, int>& a, const std::pair<float, int>& b) { return a.first > b.first; });
 }
 
 inline float absDiff(float a, float b) { return a < b ? b - a : a - b; }
@@ -114,13 +367,13 @@ float Identify::Library::checkFit(const vector<float>& samplePeaks, const vector
 {
     if (libraryPeaks.size() == 0)
     {
-        Util::log("checkFit: library compound has no peaks");
+        LOG_TRACE("checkFit: library compound has no peaks");
         return 0;
     }
 
     if (samplePeaks.size() < libraryPeaks.size())
     {
-        Util::log("checkFit: sample has too few peaks (%d < %d)", samplePeaks.size(), libraryPeaks.size());
+        LOG_TRACE("checkFit: sample has too few peaks (%d < %d)", samplePeaks.size(), libraryPeaks.size());
         return 0;
     }
 
@@ -146,11 +399,11 @@ float Identify::Library::checkFit(const vector<float>& samplePeaks, const vector
 
         float sp = samplePeaks[bestIndex];
         float dist = lp - sp;
-        Util::log("checkFit: best fit for library peak #%2d (wavenumber %.2f) is sample peak #%2d (wavenumber %.2f) for dist %.2f", i, lp, bestIndex, sp, dist);
+        LOG_TRACE("checkFit: best fit for library peak #%2d (wavenumber %.2f) is sample peak #%2d (wavenumber %.2f) for dist %.2f", i, lp, bestIndex, sp, dist);
 
         if (minDist > MAX_WAVENUMBER_OFFSET)
         {
-            Util::log("checkFit: unable to associate library peak %d with any sample peak (minDist %.2f > thresh %d)", i, minDist, MAX_WAVENUMBER_OFFSET);
+            LOG_TRACE("checkFit: unable to associate library peak %d with any sample peak (minDist %.2f > thresh %d)", i, minDist, MAX_WAVENUMBER_OFFSET);
             // return 0;
             continue;
         }
@@ -158,10 +411,10 @@ float Identify::Library::checkFit(const vector<float>& samplePeaks, const vector
         float peakScore = possibleScore * (1.f - 1.f * minDist / MAX_WAVENUMBER_OFFSET);
         totalScore += peakScore;
 
-        Util::log("checkFit: peakScore %8.2f (total %8.2f)", peakScore, totalScore);
+        LOG_TRACE("checkFit: peakScore %8.2f (total %8.2f)", peakScore, totalScore);
     }
 
-    Util::log("checkFit: returning totalScore %.2f", totalScore);
+    LOG_TRACE("checkFit: returning totalScore %.2f", totalScore);
     return totalScore;
 }
 
@@ -171,13 +424,29 @@ float Identify::Library::checkFit(const vector<float>& samplePeaks, const vector
  left-hand shoulder.
  */
 vector<float> Identify::Library::findPeakWavenumbers(const Spectrum& spectrum, int boxcarHalfWidth, int minRampPixels, int minPeakHeight) const
+{
+    return findPeakWavenumbers(spectrum.wavenumbers.data(), spectrum.intensities.data(), spectrum.pixels, boxcarHalfWidth, minRampPixels, minPeakHeight);
+}
+
+vector<float> Identify::Library::findPeakWavenumbers(const float* wavenumbers, const float* spectrum, int pixels, int boxcarHalfWidth, int minRampPixels, int minPeakHeight) const
+{
+    if (pixels < 1)
+        return vector<float>();
+
+    vector<float> smoothed = boxcar(spectrum, pixels, boxcarHalfWidth);
+    return findPeaks(wavenumbers, smoothed.data(), pixels, minRampPixels, minPeakHeight);
+}
+
+//! @param intensities an already-smoothed spectrum
+vector<float> Identify::Library::findPeaks(const float* wavenumbers, const float* intensities, int pixels, int minRampPixels, int minPeakHeight) const
 {
     vector<float> peakWavenumbers;
-    vector<float> intensities = boxcar(spectrum.intensities, boxcarHalfWidth);
+    if (pixels < 1)
+        return peakWavenumbers;
 
     int rampLeft = 0;
     float rampBase = intensities[0];
-    for (int i = 1; i < (int)spectrum.pixels - minRampPixels; i++)
+    for (int i = 1; i < pixels - minRampPixels; i++)
     {
         // is ramp increasing?
         if (intensities[i] > intensities[i-1])
@@ -197,7 +466,7 @@ vector<float> Identify::Library::findPeakWavenumbers(const Spectrum& spectrum, i
 
                     // is it HIGH ENOUGH?
                     if (intensities[i] >= rampBase + minPeakHeight)
-                        peakWavenumbers.push_back(spectrum.wavenumbers[i]);
+                        peakWavenumbers.push_back(wavenumbers[i]);
                 }
             }
         }
@@ -212,10 +481,15 @@ vector<float> Identify::Library::findPeakWavenumbers(const Spectrum& spectrum, i
 
 vector<float> Identify::Library::boxcar(const vector<float>& a, int halfWidth) const
 {
-	vector<float> smoothed(a.size());
-	for (int i = 0; i < (int)a.size(); i++)
+    return boxcar(a.data(), (int) a.size(), halfWidth);
+}
+
+vector<float> Identify::Library::boxcar(const float* a, int pixels, int halfWidth) const
+{
+	vector<float> smoothed(pixels);
+	for (int i = 0; i < pixels; i++)
     {
-        if (i < halfWidth || i + halfWidth >= (int)a.size())
+        if (i < halfWidth || i + halfWidth >= pixels)
             smoothed[i] = a[i];
         else
         {
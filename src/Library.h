@@ -2,32 +2,103 @@
 #define IDENTIFY_LIBRARY_H
 
 #include <map>
+#include <atomic>
+#include <chrono>
 #include <vector>
 #include <string>
 
+#include <stdint.h>
+
 #include "Spectrum.h"
 #include "LibrarySpectrum.h"
+#include "Timing.h"
 
 namespace Identify
 {
+    //! one scored library compound
+    struct Match
+    {
+        const LibrarySpectrum* compound;
+        float score;
+    };
+
+    //! cooperative limits on a single identification, checked between compounds
+    struct Budget
+    {
+        const std::atomic<bool>* cancel = nullptr; //!< give up as soon as this is set
+
+        bool hasDeadline = false;
+        std::chrono::steady_clock::time_point deadline; //!< return best-so-far after this
+
+        //! expire 'ms' milliseconds from now (no limit if ms <= 0)
+        void setTimeout(int ms)
+        {
+            hasDeadline = ms > 0;
+            if (hasDeadline)
+                deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+        }
+    };
+
     //! A deliberately simple, naive Raman identification algorithm.
     class Library 
     {
         public:
             //! instantiate a Llibrary with multiple compounds
+            //! @param pathname directory of CSV spectra, or a compiled peak-list file
             Library(const std::string& pathname);
 
             //! return the name and score of the best-matching compound, if any (neg otherwise)
             std::string identify(const Identify::Spectrum& sample, float& score) const;
 
+            //! populate 'matches' with up to maxResults compounds, best first
+            //! @param timing (optional) accumulates the boxcar, peaks and scan stages
+            //! @returns false if the budget ran out before every compound was scored
+            bool identify(const Identify::Spectrum& sample, int maxResults, std::vector<Match>& matches, const Budget* budget = nullptr, Timing* timing = nullptr) const;
+
+            //! as above, reading the sample in place (e.g. from a shared-memory slot)
+            bool identify(const float* wavenumbers, const float* intensities, int pixels, int maxResults, std::vector<Match>& matches, const Budget* budget = nullptr, Timing* timing = nullptr) const;
+
+            //! as above, in two steps: find the sample's peaks (timing the boxcar and peaks stages)...
+            std::vector<float> samplePeaks(const float* wavenumbers, const float* intensities, int pixels, Timing* timing = nullptr) const;
+
+            //! ...then score them (timing the scan), so they can be kept and re-scored later
+            bool identify(const std::vector<float>& samplePeaks, int maxResults, std::vector<Match>& matches, const Budget* budget = nullptr, Timing* timing = nullptr) const;
+
+            //! a hash of the compounds and scoring parameters: results can be
+            //! reused from a library of the same generation
+            uint64_t generation() const { return gen; }
+
+            //! a hash of the sample peak-finding parameters
+            static uint64_t sampleParameters();
+
+            //! number of compounds
+            size_t size() const { return compounds.size(); }
+
+            //! compounds by index, in name order
+            const LibrarySpectrum& compound(size_t i) const { return compounds[i]; }
+            size_t indexOf(const LibrarySpectrum& c) const { return &c - compounds.data(); }
+
+            //! approximate heap and object footprint of the loaded compounds
+            size_t bytes() const;
+
         private:
+            friend class KernelBench; //!< bench/kernels.cpp times the private stages
+
             void add(const Identify::Spectrum& spectrum);
+            void loadPeaks(const std::string& pathname);
             float checkFit(const std::vector<float>& samplePeaks, const std::vector<float>& libraryPeaks) const;
+            void rankCompounds(const std::vector<float>& samplePeaks, std::vector<std::pair<float, int>>& ranked) const;
 
             std::vector<float> findPeakWavenumbers(const Identify::Spectrum& spectrum, int boxcar, int minRampWidth, int minPeakHeight) const;
+            std::vector<float> findPeakWavenumbers(const float* wavenumbers, const float* intensities, int pixels, int boxcar, int minRampWidth, int minPeakHeight) const;
+            std::vector<float> findPeaks(const float* wavenumbers, const float* smoothed, int pixels, int minRampWidth, int minPeakHeight) const;
             std::vector<float> boxcar(const std::vector<float>& spectrum, int halfWidth) const;
+            std::vector<float> boxcar(const float* spectrum, int pixels, int halfWidth) const;
 
-            std::map<std::string, std::vector<float>> libraryPeakWavenumbers;
+            std::vector<LibrarySpectrum> compounds; //!< sorted by name
+            uint64_t gen = 0;
+            float peakLo = 0; //!< lowest library peak (@see rankCompounds)
+            float peakHi = 0; //!< highest library peak
     };
 }
 
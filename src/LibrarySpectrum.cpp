@@ -1,9 +1,12 @@
 #include "LibrarySpectrum.h"
 
+#include "Util.h"
+
 using std::string;
 using std::vector;
 
 Identify::LibrarySpectrum::LibrarySpectrum(const string& name, vector<float> peakWavenumbers)
     : name(name), peakWavenumbers(peakWavenumbers)
 {
+    jsonName = Util::jsonEscape(name);
 }
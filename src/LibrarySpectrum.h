@@ -15,6 +15,7 @@ namespace Identify
         // attributes
         public:
             std::string name;
+            std::string jsonName; //!< name escaped for JSON output, computed once at load
             std::vector<float> peakWavenumbers;
     };
 }
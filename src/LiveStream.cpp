@@ -0,0 +1,102 @@
+#include "LiveStream.h"
+
+#include "Util.h"
+
+#include <thread>
+#include <vector>
+
+using std::mutex;
+using std::vector;
+using std::istream;
+using std::shared_ptr;
+using std::unique_lock;
+
+Identify::LiveStream::LiveStream(const Library& library, ResponseWriter& writer, int patienceMS)
+    : library(library), writer(writer), patience(patienceMS), cancel(false)
+{
+}
+
+void Identify::LiveStream::run(istream& is)
+{
+    std::thread reader(&LiveStream::read, this, std::ref(is));
+
+    vector<Match> matches;
+    while (true)
+    {
+        shared_ptr<StreamRequestJSON> request;
+        {
+            unique_lock<mutex> guard(lock);
+            arrived.wait(guard, [this] { return pending || eof; });
+            if (!pending)
+                break;
+            request.swap(pending);
+            cancel = false;
+            busy = true;
+            started = std::chrono::steady_clock::now();
+        }
+
+        Budget budget;
+        budget.cancel = &cancel;
+        budget.setTimeout(request->deadline_ms);
+        Timing* timing = writer.wantsTiming(*request) ? &request->timings : nullptr;
+        if (library.identify(request->spectrum, request->max_results, matches, &budget, timing))
+            writer.writeMatches(*request, matches, false, timing);
+        else if (cancel)
+            writer.writeSkipped(*request);
+        else
+            writer.writeMatches(*request, matches, true, timing); // out of time
+        writer.flush();
+
+        unique_lock<mutex> guard(lock);
+        busy = false;
+    }
+
+    reader.join();
+}
+
+//! reader thread: parse everything that arrives, keeping only the newest
+void Identify::LiveStream::read(istream& is)
+{
+    while (!is.eof())
+    {
+        shared_ptr<StreamRequestJSON> request(new StreamRequestJSON(is));
+        if (!request->valid && request->error.size())
+        {
+            writer.writeError(*request);
+            writer.flush();
+            continue;
+        }
+        if (!request->valid || request->isQuit)
+        {
+            LOG_DEBUG("LiveStream: bad request (valid %s, isQuit %s)", 
+                request->valid  ? "true" : "false", 
+                request->isQuit ? "true" : "false");
+            break;
+        }
+
+        shared_ptr<StreamRequestJSON> superseded;
+        {
+            unique_lock<mutex> guard(lock);
+            superseded.swap(pending);
+            pending = request;
+
+            // whatever is in flight is stale too; give up on it if it's slow
+            if (busy && std::chrono::steady_clock::now() - started >= patience)
+                cancel = true;
+        }
+        arrived.notify_one();
+
+        if (superseded)
+        {
+            LOG_DEBUG("LiveStream: skipping superseded request");
+            writer.writeSkipped(*superseded);
+            writer.flush();
+        }
+    }
+
+    {
+        unique_lock<mutex> guard(lock);
+        eof = true;
+    }
+    arrived.notify_one();
+}
@@ -0,0 +1,57 @@
+#ifndef IDENTIFY_LIVE_STREAM_H
+#define IDENTIFY_LIVE_STREAM_H
+
+#include "StreamRequestJSON.h"
+#include "ResponseWriter.h"
+#include "Library.h"
+
+#include <condition_variable>
+#include <chrono>
+#include <istream>
+#include <memory>
+#include <atomic>
+#include <mutex>
+
+namespace Identify
+{
+    /**
+        "Latest wins" variant of the streaming loop, for live acquisition.
+
+        A reader thread drains the input as fast as it arrives, keeping only the
+        newest request.  Whatever it supersedes is answered at once with a 
+        "skipped" status.  The request being identified is also superseded 
+        (cancelled between compounds, and likewise answered "skipped") if it
+        has already run for longer than the patience -- so a pathological 
+        spectrum can't hold up the live view, yet under steady overload 
+        results still get through.  Latency therefore stays bounded however
+        far the client runs ahead.
+    */
+    class LiveStream
+    {
+        public:
+            //! @param patienceMS how long in-flight work may run once superseded
+            LiveStream(const Library& library, ResponseWriter& writer, int patienceMS = 50);
+
+            //! process 'is' until EOF or a bad request
+            void run(std::istream& is);
+
+        private:
+            void read(std::istream& is);
+
+            const Library& library;
+            ResponseWriter& writer;
+
+            std::mutex lock;
+            std::condition_variable arrived;
+            std::shared_ptr<StreamRequestJSON> pending; //!< newest request not yet started
+            bool busy = false;                          //!< a request is being identified
+            std::chrono::steady_clock::time_point started; //!< ...since when
+            bool eof = false;
+
+            std::chrono::milliseconds patience;
+
+            std::atomic<bool> cancel; //!< set when the in-flight request is superseded
+    };
+}
+
+#endif
@@ -0,0 +1,81 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#include <fstream>
+#include <iterator>
+#else
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+using std::string;
+
+#ifdef _WIN32
+
+Identify::MappedFile::MappedFile(const string& pathname)
+{
+    std::ifstream f(pathname, std::ios_base::in | std::ios_base::binary);
+    if (!f)
+        return;
+    buffer.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+    data = buffer.data();
+    length = buffer.size();
+    ok = true;
+}
+
+Identify::MappedFile::~MappedFile()
+{
+}
+
+#else
+
+Identify::MappedFile::MappedFile(const string& pathname)
+{
+    int fd = open(pathname.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+
+    struct stat s;
+    if (fstat(fd, &s) < 0 || (s.st_mode & S_IFDIR))
+    {
+        close(fd);
+        return;
+    }
+
+    ok = true;
+    length = s.st_size;
+    if (length > 0)
+    {
+        // spectra are read start to finish, so fault every page in up front
+        int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+        flags |= MAP_POPULATE;
+#endif
+        void* p = mmap(nullptr, length, PROT_READ, flags, fd, 0);
+        if (p != MAP_FAILED)
+        {
+            data = static_cast<const char*>(p);
+            mapped = true;
+        }
+        else
+        {
+            // e.g. a filesystem which can't be mapped: read it instead
+            buffer.resize(length);
+            ssize_t n = pread(fd, buffer.data(), length, 0);
+            length = n > 0 ? n : 0;
+            data = buffer.data();
+        }
+    }
+    close(fd);
+}
+
+Identify::MappedFile::~MappedFile()
+{
+    if (mapped)
+        munmap(const_cast<char*>(data), length);
+}
+
+#endif
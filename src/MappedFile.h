@@ -0,0 +1,43 @@
+#ifndef IDENTIFY_MAPPED_FILE_H
+#define IDENTIFY_MAPPED_FILE_H
+
+#include <string>
+#include <vector>
+
+#include <stddef.h>
+
+namespace Identify
+{
+    /**
+        A read-only view of a whole file, memory-mapped where the platform
+        allows (and simply read into memory where it doesn't).
+
+        The contents are not NUL-terminated; parsers must stop at end().
+    */
+    class MappedFile
+    {
+        public:
+            MappedFile(const std::string& pathname);
+            MappedFile() {} //!< no file (not valid)
+            ~MappedFile();
+
+            //! false if the file couldn't be opened (an empty file is valid)
+            bool valid() const { return ok; }
+
+            const char* begin() const { return data; }
+            const char* end() const { return data + length; }
+            size_t size() const { return length; }
+
+        private:
+            MappedFile(const MappedFile&);            //!< not copyable
+            MappedFile& operator=(const MappedFile&); //!< not assignable
+
+            bool ok = false;
+            bool mapped = false;
+            const char* data = nullptr;
+            size_t length = 0;
+            std::vector<char> buffer; //!< contents, where not mapped
+    };
+}
+
+#endif
@@ -0,0 +1,271 @@
+#include "Metrics.h"
+#include "StreamRequestJSON.h"
+
+#include "Util.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <signal.h>
+#include <sys/resource.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+
+using std::string;
+using std::atomic;
+
+////////////////////////////////////////////////////////////////////////////////
+// Histogram
+////////////////////////////////////////////////////////////////////////////////
+
+Identify::Histogram::Histogram()
+    : total(0), sum(0), max(0)
+{
+    for (int i = 0; i < BUCKETS; i++)
+        counts[i].store(0, std::memory_order_relaxed);
+}
+
+//! index of the highest set bit (v > 0)
+static int msb(uint64_t v)
+{
+#ifdef __GNUC__
+    return 63 - __builtin_clzll(v);
+#else
+    int bit = 0;
+    while (v >>= 1)
+        bit++;
+    return bit;
+#endif
+}
+
+int Identify::Histogram::bucketOf(uint64_t ns)
+{
+    if (ns < (uint64_t) SUB)
+        return (int) ns;
+    int shift = msb(ns) - SUB_BITS;
+    int bucket = (shift + 1) * SUB + (int) ((ns >> shift) - SUB);
+    return bucket < BUCKETS ? bucket : BUCKETS - 1;
+}
+
+uint64_t Identify::Histogram::upperEdge(int bucket)
+{
+    if (bucket < SUB)
+        return bucket;
+    int shift = bucket / SUB - 1;
+    uint64_t base = (uint64_t) (bucket % SUB + SUB) << shift;
+    return base + ((uint64_t) 1 << shift) - 1;
+}
+
+void Identify::Histogram::record(uint64_t ns)
+{
+    counts[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(ns, std::memory_order_relaxed);
+
+    uint64_t prev = max.load(std::memory_order_relaxed);
+    while (ns > prev && !max.compare_exchange_weak(prev, ns, std::memory_order_relaxed))
+        ;
+}
+
+uint64_t Identify::Histogram::quantile(double q) const
+{
+    uint64_t n = count();
+    if (!n)
+        return 0;
+
+    uint64_t rank = (uint64_t) (q * n + 0.5);
+    if (rank < 1)
+        rank = 1;
+
+    uint64_t seen = 0;
+    uint64_t largest = max.load(std::memory_order_relaxed);
+    for (int i = 0; i < BUCKETS; i++)
+    {
+        seen += counts[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+        {
+            uint64_t edge = upperEdge(i);
+            return edge < largest ? edge : largest;
+        }
+    }
+    return largest;
+}
+
+string Identify::Histogram::toJSON() const
+{
+    uint64_t n = count();
+    double mean = n ? sum.load(std::memory_order_relaxed) / 1000.0 / n : 0;
+    return Util::sprintf("{ \"Count\": %llu, \"Mean\": %.1f, \"P50\": %.1f, \"P90\": %.1f, \"P99\": %.1f, \"P999\": %.1f, \"Max\": %.1f }",
+        (unsigned long long) n, mean,
+        quantile(0.5) / 1000.0, quantile(0.9) / 1000.0, quantile(0.99) / 1000.0, quantile(0.999) / 1000.0,
+        max.load(std::memory_order_relaxed) / 1000.0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Metrics
+////////////////////////////////////////////////////////////////////////////////
+
+//! write end of the active Metrics' wake pipe, for the signal handler
+static int signalFd = -1;
+
+#ifndef _WIN32
+static void onSignal(int)
+{
+    int saved = errno;
+    char c = 'd';
+    if (signalFd >= 0 && write(signalFd, &c, 1) < 0)
+        ; // nothing useful to do in a handler
+    errno = saved;
+}
+#endif
+
+Identify::Metrics::Metrics(const Library& library, const string& pathname)
+    : library(library),
+      pathname(pathname),
+      started(std::chrono::steady_clock::now()),
+      requests(0),
+      errors(0),
+      partials(0),
+      skipped(0)
+{
+    wakeFds[0] = wakeFds[1] = -1;
+#ifndef _WIN32
+    if (pipe(wakeFds) < 0)
+    {
+        LOG_INFO("Metrics: pipe failed (SIGUSR1 dumps disabled)");
+        return;
+    }
+    signalFd = wakeFds[1];
+
+    // SA_RESTART, so that a dump doesn't interrupt a blocking read of stdin
+    struct sigaction sa = {};
+    sa.sa_handler = onSignal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, nullptr);
+
+    listener = std::thread(&Metrics::listen, this);
+#endif
+}
+
+Identify::Metrics::~Metrics()
+{
+#ifndef _WIN32
+    if (listener.joinable())
+    {
+        signal(SIGUSR1, SIG_DFL);
+        signalFd = -1;
+        char c = 'q';
+        if (::write(wakeFds[1], &c, 1) == 1)
+            listener.join();
+        else
+            listener.detach();
+        close(wakeFds[0]);
+        close(wakeFds[1]);
+    }
+#endif
+    dump();
+}
+
+void Identify::Metrics::listen()
+{
+#ifndef _WIN32
+    char c;
+    while (true)
+    {
+        ssize_t n = ::read(wakeFds[0], &c, 1);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0 || c == 'q')
+            break;
+        dump();
+    }
+#endif
+}
+
+//! Timing stages are in (fractional) microseconds
+static uint64_t toNS(double us)
+{
+    return us > 0 ? (uint64_t) (us * 1000 + 0.5) : 0;
+}
+
+void Identify::Metrics::recordRequest(const Timing* timing, bool partial)
+{
+    requests.fetch_add(1, std::memory_order_relaxed);
+    if (partial)
+        partials.fetch_add(1, std::memory_order_relaxed);
+    if (!timing)
+        return;
+
+    total .record(toNS(timing->parse + timing->boxcar + timing->peaks + timing->scan + timing->output));
+    read  .record(toNS(timing->read));
+    parse .record(toNS(timing->parse));
+    boxcar.record(toNS(timing->boxcar));
+    peaks .record(toNS(timing->peaks));
+    scan  .record(toNS(timing->scan));
+    output.record(toNS(timing->output));
+}
+
+string Identify::Metrics::toJSON() const
+{
+    double uptime = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    const AxisCache& axes = StreamRequestJSON::axisCache();
+    uint64_t hits = axes.hits(), misses = axes.misses();
+
+    long peakRSS = 0;
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        peakRSS = usage.ru_maxrss;
+#ifdef __APPLE__
+    peakRSS /= 1024; // bytes on MacOS, KB elsewhere
+#endif
+#endif
+
+    string json = Util::sprintf("{ \"Metrics\": { \"Uptime\": %.1f, \"Requests\": %llu, \"Errors\": %llu, \"Partial\": %llu, \"Skipped\": %llu, ",
+        uptime,
+        (unsigned long long) requests.load(std::memory_order_relaxed),
+        (unsigned long long) errors.load(std::memory_order_relaxed),
+        (unsigned long long) partials.load(std::memory_order_relaxed),
+        (unsigned long long) skipped.load(std::memory_order_relaxed));
+    json += Util::sprintf("\"AxisCache\": { \"Hits\": %llu, \"Misses\": %llu, \"HitRate\": %.3f }, ",
+        (unsigned long long) hits, (unsigned long long) misses, hits + misses ? 1.0 * hits / (hits + misses) : 0.0);
+    json += Util::sprintf("\"Library\": { \"Compounds\": %lu, \"Bytes\": %lu }, \"PeakRSSKB\": %ld, ",
+        (unsigned long) library.size(), (unsigned long) library.bytes(), peakRSS);
+
+    json += "\"LatencyUS\": { ";
+    json += "\"Total\": "  + total.toJSON()  + ", ";
+    json += "\"Read\": "   + read.toJSON()   + ", ";
+    json += "\"Parse\": "  + parse.toJSON()  + ", ";
+    json += "\"Boxcar\": " + boxcar.toJSON() + ", ";
+    json += "\"Peaks\": "  + peaks.toJSON()  + ", ";
+    json += "\"Scan\": "   + scan.toJSON()   + ", ";
+    json += "\"Output\": " + output.toJSON() + " } } }\n";
+    return json;
+}
+
+void Identify::Metrics::dump() const
+{
+    string json = toJSON();
+    if (pathname.empty())
+    {
+        fputs(json.c_str(), stderr);
+        fflush(stderr);
+        return;
+    }
+
+    // write-then-rename, so readers never see a half-written file
+    string tmp = pathname + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "w");
+    if (!f)
+    {
+        LOG_INFO("Metrics: unable to write %s", tmp.c_str());
+        return;
+    }
+    fputs(json.c_str(), f);
+    fclose(f);
+    if (rename(tmp.c_str(), pathname.c_str()) != 0)
+        LOG_INFO("Metrics: unable to rename %s to %s", tmp.c_str(), pathname.c_str());
+}
@@ -0,0 +1,106 @@
+#ifndef IDENTIFY_METRICS_H
+#define IDENTIFY_METRICS_H
+
+#include "Library.h"
+#include "Timing.h"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include <stdint.h>
+
+namespace Identify
+{
+    /**
+        A lock-free log-linear ("HDR-style") histogram of durations.
+
+        Values below 32ns are counted exactly; above that each power of two is
+        split into 32 linear sub-buckets, so any recorded value is reported to
+        within ~3% while the whole range up to ~18 minutes fits in a fixed
+        array.  Recording is a relaxed atomic increment, safe from any thread.
+    */
+    class Histogram
+    {
+        public:
+            Histogram();
+
+            void record(uint64_t ns);
+
+            uint64_t count() const { return total.load(std::memory_order_relaxed); }
+
+            //! @param q quantile in [0, 1] (0.5 = median)
+            //! @returns the upper edge of the bucket holding that quantile, in ns
+            uint64_t quantile(double q) const;
+
+            //! { "Count": n, "Mean": us, "P50": us, "P90": us, "P99": us, "P999": us, "Max": us }
+            std::string toJSON() const;
+
+        private:
+            static const int SUB_BITS = 5;
+            static const int SUB = 1 << SUB_BITS;
+            static const int BUCKETS = (40 - SUB_BITS + 1) * SUB;
+
+            static int bucketOf(uint64_t ns);
+            static uint64_t upperEdge(int bucket);
+
+            std::atomic<uint64_t> counts[BUCKETS];
+            std::atomic<uint64_t> total;
+            std::atomic<uint64_t> sum;
+            std::atomic<uint64_t> max;
+    };
+
+    /**
+        Process-wide counters and per-stage latency histograms for a streaming
+        session, written as one JSON document on SIGUSR1 and at exit.
+
+        Requests are recorded by the ResponseWriter as they're answered (@see
+        ResponseWriter::setMetrics); dumping happens on a separate thread, so
+        neither the signal handler nor the request path takes a lock.
+    */
+    class Metrics
+    {
+        public:
+            //! @param pathname file to (over)write on each dump (empty = stderr)
+            Metrics(const Library& library, const std::string& pathname);
+
+            //! writes a final dump
+            ~Metrics();
+
+            //! @param timing stages of the request (may be null if not timed)
+            void recordRequest(const Timing* timing, bool partial);
+            void recordError()   { errors.fetch_add(1, std::memory_order_relaxed); }
+            void recordSkipped() { skipped.fetch_add(1, std::memory_order_relaxed); }
+
+            std::string toJSON() const;
+
+            //! write toJSON() to the side file, or stderr
+            void dump() const;
+
+        private:
+            void listen();
+
+            const Library& library;
+            std::string pathname;
+            std::chrono::steady_clock::time_point started;
+
+            std::atomic<uint64_t> requests;
+            std::atomic<uint64_t> errors;
+            std::atomic<uint64_t> partials;
+            std::atomic<uint64_t> skipped;
+
+            Histogram total;    //!< everything but read (which includes idle waiting)
+            Histogram read;
+            Histogram parse;
+            Histogram boxcar;
+            Histogram peaks;
+            Histogram scan;
+            Histogram output;
+
+            std::thread listener; //!< waits for SIGUSR1
+            int wakeFds[2];
+    };
+}
+
+#endif
@@ -0,0 +1,448 @@
+#include "PathSource.h"
+
+#include "Util.h"
+
+#ifdef _WIN32
+#include "save\dirent.h"
+#else
+#include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/inotify.h>
+#include <signal.h>
+#include <poll.h>
+#endif
+
+#include <iostream>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+
+using std::list;
+using std::string;
+using std::vector;
+
+////////////////////////////////////////////////////////////////////////////////
+// DirectoryPathSource
+////////////////////////////////////////////////////////////////////////////////
+
+#define DIRENT_BUFFER (32 * 1024) // bytes of directory entries read per getdents64
+
+#ifdef __linux__
+
+//! as returned by getdents64 (glibc only declares a wrapper from 2.30)
+struct linux_dirent64
+{
+    uint64_t       d_ino;
+    int64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+};
+
+struct Identify::DirectoryPathSource::Level
+{
+    string path;
+    int fd = -1;
+    vector<char> buffer;
+    long pos = 0;
+    long len = 0;
+
+    //! @returns false at the end of the directory
+    bool read(const char*& name, int& type)
+    {
+        if (pos >= len)
+        {
+            buffer.resize(DIRENT_BUFFER);
+            len = syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+            pos = 0;
+            if (len <= 0)
+            {
+                if (len < 0)
+                    fprintf(stderr, "unable to read directory %s: %s\n", path.c_str(), strerror(errno));
+                return false;
+            }
+        }
+        const linux_dirent64* d = reinterpret_cast<const linux_dirent64*>(buffer.data() + pos);
+        pos += d->d_reclen;
+        name = d->d_name;
+        type = d->d_type;
+        return true;
+    }
+
+    //! file type (as DT_*) by following the entry
+    int follow(const char* name)
+    {
+        struct stat s;
+        if (fstatat(fd, name, &s, 0) < 0)
+            return DT_UNKNOWN;
+        return S_ISDIR(s.st_mode) ? DT_DIR : S_ISREG(s.st_mode) ? DT_REG : DT_UNKNOWN;
+    }
+
+    ~Level()
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+};
+
+void Identify::DirectoryPathSource::push(const string& path, int parentFd, const char* name)
+{
+    int fd = parentFd >= 0 ? openat(parentFd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)
+                           : open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        fprintf(stderr, "unable to open directory %s: %s\n", path.c_str(), strerror(errno));
+        return;
+    }
+    Level* level = new Level;
+    level->path = path;
+    level->fd = fd;
+    stack.push_back(level);
+}
+
+#else
+
+struct Identify::DirectoryPathSource::Level
+{
+    string path;
+    DIR* dir = nullptr;
+
+    bool read(const char*& name, int& type)
+    {
+        struct dirent* d = readdir(dir);
+        if (!d)
+            return false;
+        name = d->d_name;
+        type = d->d_type;
+        return true;
+    }
+
+    int follow(const char* name)
+    {
+        struct stat s;
+        if (stat((path + "/" + name).c_str(), &s) < 0)
+            return DT_UNKNOWN;
+        return S_ISDIR(s.st_mode) ? DT_DIR : S_ISREG(s.st_mode) ? DT_REG : DT_UNKNOWN;
+    }
+
+    ~Level()
+    {
+        if (dir)
+            closedir(dir);
+    }
+};
+
+void Identify::DirectoryPathSource::push(const string& path, int parentFd, const char* name)
+{
+    DIR* dir = opendir(path.c_str());
+    if (!dir)
+    {
+        fprintf(stderr, "unable to open directory %s\n", path.c_str());
+        return;
+    }
+    Level* level = new Level;
+    level->path = path;
+    level->dir = dir;
+    stack.push_back(level);
+}
+
+#endif
+
+Identify::DirectoryPathSource::DirectoryPathSource(const string& root)
+{
+    string path(root);
+    while (path.size() > 1 && path[path.size() - 1] == '/')
+        path.erase(path.size() - 1);
+    push(path, -1, nullptr);
+}
+
+Identify::DirectoryPathSource::~DirectoryPathSource()
+{
+    while (!stack.empty())
+        pop();
+}
+
+void Identify::DirectoryPathSource::pop()
+{
+    delete stack.back();
+    stack.pop_back();
+}
+
+bool Identify::DirectoryPathSource::next(string& pathname)
+{
+    while (!stack.empty())
+    {
+        Level* level = stack.back();
+
+        const char* name;
+        int type;
+        if (!level->read(name, type))
+        {
+            pop();
+            continue;
+        }
+
+        // also skips "." and ".."
+        if (name[0] == '.')
+            continue;
+
+        // only look closer when the filesystem doesn't say (and don't
+        // descend through links to directories)
+        if (type == DT_UNKNOWN)
+            type = level->follow(name);
+        else if (type == DT_LNK)
+        {
+            type = level->follow(name);
+            if (type == DT_DIR)
+                continue;
+        }
+
+        if (type == DT_DIR)
+        {
+#ifdef __linux__
+            push(level->path + "/" + name, level->fd, name);
+#else
+            push(level->path + "/" + name, -1, name);
+#endif
+        }
+        else if (type == DT_REG && Util::endsWith(name, ".csv"))
+        {
+            pathname = level->path + "/" + name;
+            return true;
+        }
+    }
+    return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// ListPathSource
+////////////////////////////////////////////////////////////////////////////////
+
+Identify::ListPathSource::ListPathSource(const list<const char*>& files, bool recursive) :
+    files(files),
+    it(files.begin()),
+    recursive(recursive)
+{
+}
+
+bool Identify::ListPathSource::next(string& pathname)
+{
+    while (true)
+    {
+        if (directory)
+        {
+            if (directory->next(pathname))
+                return true;
+            directory.reset();
+        }
+
+        if (it == files.end())
+            return false;
+
+        const char* arg = *it++;
+        struct stat s;
+        if (stat(arg, &s) == 0)
+        {
+            if (s.st_mode & S_IFDIR)
+            {
+                if (recursive)
+                    directory.reset(new DirectoryPathSource(arg));
+                else
+                    LOG_DEBUG("Skipping directory");
+                continue;
+            }
+        }
+
+        pathname = arg;
+        return true;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// ManifestPathSource
+////////////////////////////////////////////////////////////////////////////////
+
+Identify::ManifestPathSource::ManifestPathSource(const string& pathname)
+{
+    if (pathname == "-")
+        is = &std::cin;
+    else
+    {
+        file.open(pathname);
+        if (!file)
+            fprintf(stderr, "unable to read manifest %s\n", pathname.c_str());
+        is = &file;
+    }
+}
+
+bool Identify::ManifestPathSource::next(string& pathname)
+{
+    while (std::getline(*is, pathname))
+    {
+        Util::trim(pathname);
+        if (pathname.size() && pathname[0] != '#')
+            return true;
+    }
+    return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// WatchPathSource
+////////////////////////////////////////////////////////////////////////////////
+
+#define INOTIFY_BUFFER (64 * 1024) // bytes of events read at once
+
+#ifdef __linux__
+
+//! write end of the active watch's wake pipe, for the signal handler
+static int watchSignalFd = -1;
+
+static void onWatchSignal(int)
+{
+    int saved = errno;
+    char c = 'q';
+    if (watchSignalFd >= 0 && write(watchSignalFd, &c, 1) < 0)
+        ; // nothing useful to do in a handler
+    errno = saved;
+}
+
+Identify::WatchPathSource::WatchPathSource(const string& path) :
+    dir(path)
+{
+    while (dir.size() > 1 && dir.back() == '/')
+        dir.pop_back();
+
+    fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR | IN_DELETE_SELF | IN_MOVE_SELF) < 0)
+    {
+        fprintf(stderr, "unable to watch %s: %s\n", dir.c_str(), strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
+        return;
+    }
+
+    // stop cleanly on ^C, so results (and any store) are flushed
+    if (pipe(wakeFds) == 0)
+    {
+        watchSignalFd = wakeFds[1];
+        struct sigaction sa = {};
+        sa.sa_handler = onWatchSignal;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGINT, &sa, nullptr);
+        sigaction(SIGTERM, &sa, nullptr);
+    }
+    LOG_DEBUG("WatchPathSource: watching %s", dir.c_str());
+}
+
+Identify::WatchPathSource::~WatchPathSource()
+{
+    if (wakeFds[0] >= 0)
+    {
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        watchSignalFd = -1;
+        close(wakeFds[0]);
+        close(wakeFds[1]);
+    }
+    if (fd >= 0)
+        close(fd);
+}
+
+bool Identify::WatchPathSource::next(string& pathname)
+{
+    if (fd < 0)
+        return false;
+
+    vector<char> buffer;
+    while (ready.empty())
+    {
+        struct pollfd fds[2] = { { fd, POLLIN, 0 }, { wakeFds[0], POLLIN, 0 } };
+        if (poll(fds, wakeFds[0] >= 0 ? 2 : 1, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        if (fds[1].revents)
+        {
+            LOG_DEBUG("WatchPathSource: stopping");
+            return false;
+        }
+
+        buffer.resize(INOTIFY_BUFFER);
+        ssize_t n = read(fd, buffer.data(), buffer.size());
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+
+        for (const char* p = buffer.data(); p < buffer.data() + n; )
+        {
+            const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(p);
+            p += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW)
+                fprintf(stderr, "%s: too many files at once; some were missed\n", dir.c_str());
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+            {
+                fprintf(stderr, "%s: no longer watched\n", dir.c_str());
+                close(fd);
+                fd = -1;
+                break;
+            }
+            if (!event->len || (event->mask & IN_ISDIR) || event->name[0] == '.' || !Util::endsWith(event->name, ".csv"))
+                continue;
+            ready.push_back(dir + "/" + event->name);
+        }
+        if (fd < 0 && ready.empty())
+            return false;
+    }
+
+    pathname.swap(ready.front());
+    ready.pop_front();
+    LOG_DEBUG("WatchPathSource: %s", pathname.c_str());
+    return true;
+}
+
+#else
+
+Identify::WatchPathSource::WatchPathSource(const string& path) :
+    dir(path)
+{
+    fprintf(stderr, "unable to watch %s: only supported on Linux\n", dir.c_str());
+}
+
+Identify::WatchPathSource::~WatchPathSource()
+{
+}
+
+bool Identify::WatchPathSource::next(string& pathname)
+{
+    return false;
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// ChainPathSource
+////////////////////////////////////////////////////////////////////////////////
+
+bool Identify::ChainPathSource::next(string& pathname)
+{
+    while (!sources.empty())
+    {
+        if (sources.front()->next(pathname))
+            return true;
+        sources.pop_front();
+    }
+    return false;
+}
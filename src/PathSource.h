@@ -0,0 +1,127 @@
+#ifndef IDENTIFY_PATH_SOURCE_H
+#define IDENTIFY_PATH_SOURCE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <list>
+
+namespace Identify
+{
+    /**
+        Where batch mode gets the measurements to process.
+
+        Paths are pulled one at a time, as Batch has room for more work, so a
+        source may discover them lazily (and slowly) while earlier files are
+        already being identified.  A source only returns paths it believes
+        are files; directories are skipped (or traversed) by the source.
+    */
+    class PathSource
+    {
+        public:
+            virtual ~PathSource() {}
+
+            //! @returns false once there are no more paths
+            virtual bool next(std::string& pathname) = 0;
+    };
+
+    /**
+        Every *.csv file beneath a directory, depth-first, in the order the
+        filesystem lists them (not sorted, so the first results don't wait
+        for a huge directory to be read in full).
+
+        On Linux, directories are read with getdents64 relative to their
+        parent's descriptor, and each entry's d_type says whether it's a file
+        or directory, so no file is stat'd unless the filesystem doesn't
+        report types (or it's a symlink).  Hidden entries are skipped, and
+        symlinks to directories aren't followed (so there are no cycles).
+    */
+    class DirectoryPathSource : public PathSource
+    {
+        public:
+            DirectoryPathSource(const std::string& root);
+            ~DirectoryPathSource();
+            bool next(std::string& pathname);
+
+        private:
+            struct Level;
+
+            void push(const std::string& path, int parentFd, const char* name);
+            void pop();
+
+            std::vector<Level*> stack; //!< open directories, innermost last
+    };
+
+    //! the paths given on the command-line, skipping (or traversing) directories
+    class ListPathSource : public PathSource
+    {
+        public:
+            ListPathSource(const std::list<const char*>& files, bool recursive = false);
+            bool next(std::string& pathname);
+
+        private:
+            const std::list<const char*>& files;
+            std::list<const char*>::const_iterator it;
+            bool recursive;
+            std::unique_ptr<DirectoryPathSource> directory; //!< being traversed
+    };
+
+    /**
+        Paths listed one per line in a file (or on stdin, if "-"), read as
+        they're needed so the list is never held in memory and may still be
+        being written (e.g. "find ... | identify --manifest -").  Blank lines
+        and lines starting with '#' are ignored.  Entries aren't stat'd.
+    */
+    class ManifestPathSource : public PathSource
+    {
+        public:
+            ManifestPathSource(const std::string& pathname);
+            bool next(std::string& pathname);
+
+        private:
+            std::ifstream file;
+            std::istream* is;
+    };
+
+    /**
+        Files as they're completed in a directory (say, an instrument's drop
+        folder): each *.csv closed after writing, or moved in, is returned
+        as soon as inotify reports it (IN_CLOSE_WRITE, IN_MOVED_TO).  Hidden
+        files and subdirectories are ignored, so a writer can create a file
+        as ".name.csv" and rename it when it's done.
+
+        next() blocks until a file arrives.  It returns false once SIGINT or
+        SIGTERM is received, or the directory is removed, so batch mode can
+        finish (and flush) cleanly.  Linux only.
+    */
+    class WatchPathSource : public PathSource
+    {
+        public:
+            WatchPathSource(const std::string& dir);
+            ~WatchPathSource();
+            bool next(std::string& pathname);
+
+            //! false if the directory couldn't be watched
+            bool valid() const { return fd >= 0; }
+
+        private:
+            std::string dir;
+            int fd = -1;
+            int wakeFds[2] = { -1, -1 }; //!< signal handler -> next()
+            std::list<std::string> ready; //!< names from events already read
+    };
+
+    //! each source in turn
+    class ChainPathSource : public PathSource
+    {
+        public:
+            void add(PathSource* source) { sources.push_back(std::unique_ptr<PathSource>(source)); }
+            bool next(std::string& pathname);
+
+        private:
+            std::list<std::unique_ptr<PathSource>> sources;
+    };
+}
+
+#endif
@@ -0,0 +1,412 @@
+#include "Prefetcher.h"
+
+#include "Util.h"
+
+#include <algorithm>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#endif
+
+#ifdef IDENTIFY_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#endif
+
+using std::string;
+using std::vector;
+using std::mutex;
+using std::unique_lock;
+
+typedef std::chrono::steady_clock Clock;
+
+Identify::Prefetcher::Prefetcher(PathSource& source, unsigned depth, size_t bufferBytes, unsigned held, bool threads) :
+    source(source),
+    depth(depth ? depth : 1),
+    files(this->depth + held)
+{
+    for (auto& file : files)
+    {
+        buffers.push_back(std::unique_ptr<char[]>(new char[bufferBytes])); // (untouched pages cost nothing)
+        file.data = buffers.back().get();
+        file.capacity = bufferBytes;
+        idle.push_back(&file);
+    }
+
+#ifdef IDENTIFY_IO_URING
+    if (!threads && ringSetup(this->depth))
+        return;
+#endif
+    readers.reset(new WorkerPool(this->depth));
+}
+
+Identify::Prefetcher::~Prefetcher()
+{
+    // don't free buffers the kernel (or a reader) may still be writing
+#ifdef IDENTIFY_IO_URING
+    if (ring >= 0)
+    {
+        while (!pending.empty())
+        {
+            File* file = pending.front();
+            if (file->done)
+                pending.pop_front();
+            else
+                ringReap(true);
+        }
+        ringTeardown();
+    }
+#endif
+    if (readers)
+        readers->wait();
+}
+
+const char* Identify::Prefetcher::backend() const
+{
+    return readers ? "threads" : "io_uring";
+}
+
+string Identify::Prefetcher::report() const
+{
+    double seconds = count ? std::chrono::duration<double>(Clock::now() - started).count() : 0;
+    double mb = bytes / 1e6;
+    return Util::sprintf("prefetch (%s, %u in flight): %lu files, %.1f MB in %.3f s = %.1f MB/s, %.0f files/s; "
+        "waited %.3f s for reads; %lu larger than the buffer",
+        backend(), depth, (unsigned long) count, mb, seconds, seconds > 0 ? mb / seconds : 0,
+        seconds > 0 ? count / seconds : 0, stalled, (unsigned long) oversized);
+}
+
+Identify::Prefetcher::File* Identify::Prefetcher::next()
+{
+    if (!count && pending.empty())
+        started = Clock::now();
+
+    // start reads, waiting for a buffer if the caller holds them all
+    while (true)
+    {
+        fill();
+        if (!pending.empty() || exhausted)
+            break;
+        unique_lock<mutex> guard(lock);
+        changed.wait(guard, [this] { return !idle.empty(); });
+    }
+    if (pending.empty())
+        return nullptr;
+
+    File* file = pending.front();
+    Clock::time_point waiting = Clock::now();
+    bool waited = false;
+#ifdef IDENTIFY_IO_URING
+    if (ring >= 0)
+    {
+        while (!file->done)
+        {
+            ringReap(true);
+            waited = true;
+        }
+    }
+    else
+#endif
+    {
+        unique_lock<mutex> guard(lock);
+        waited = !file->done;
+        changed.wait(guard, [file] { return file->done; });
+    }
+    if (waited)
+        stalled += std::chrono::duration<double>(Clock::now() - waiting).count();
+    pending.pop_front();
+
+    count++;
+    bytes += file->length;
+    if (file->ok && !file->complete)
+        oversized++;
+
+    // keep the pipeline full behind it
+    fill();
+#ifdef IDENTIFY_IO_URING
+    if (ring >= 0)
+        ringReap(false);
+#endif
+    return file;
+}
+
+void Identify::Prefetcher::release(File* file)
+{
+    {
+        unique_lock<mutex> guard(lock);
+        idle.push_back(file);
+    }
+    changed.notify_all();
+}
+
+//! start reading more paths, while there are buffers and fewer than 'depth' in flight
+void Identify::Prefetcher::fill()
+{
+    while (!exhausted && pending.size() < depth)
+    {
+        File* file;
+        {
+            unique_lock<mutex> guard(lock);
+            if (idle.empty())
+                return;
+            file = idle.back();
+            idle.pop_back();
+        }
+
+        string pathname;
+        if (!source.next(pathname))
+        {
+            exhausted = true;
+            release(file);
+            return;
+        }
+
+        file->pathname.swap(pathname);
+        file->length = 0;
+        file->ok = false;
+        file->complete = false;
+        file->done = false;
+        file->fd = -1;
+        pending.push_back(file);
+
+#ifdef IDENTIFY_IO_URING
+        if (ring >= 0)
+        {
+            ringPush(file, true);
+            continue;
+        }
+#endif
+        readers->submit([this, file] { readBlocking(file); });
+    }
+}
+
+//! read a file on a reader thread (the fallback)
+void Identify::Prefetcher::readBlocking(File* file)
+{
+    bool ok = false;
+    bool complete = false;
+    size_t length = 0;
+#ifdef _WIN32
+    FILE* f = fopen(file->pathname.c_str(), "rb");
+    if (f)
+    {
+        ok = true;
+        length = fread(file->data, 1, file->capacity, f);
+        complete = length < file->capacity && !ferror(f);
+        fclose(f);
+    }
+#else
+    int fd = open(file->pathname.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        ok = true;
+        while (length < file->capacity)
+        {
+            ssize_t n = read(fd, file->data + length, file->capacity - length);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+            {
+                complete = n == 0;
+                break;
+            }
+            length += n;
+        }
+        close(fd);
+    }
+#endif
+
+    {
+        unique_lock<mutex> guard(lock);
+        file->ok = ok;
+        file->complete = complete;
+        file->length = length;
+        file->done = true;
+    }
+    changed.notify_all();
+}
+
+#ifdef IDENTIFY_IO_URING
+
+////////////////////////////////////////////////////////////////////////////////
+// io_uring (raw syscalls, as liburing isn't a dependency)
+////////////////////////////////////////////////////////////////////////////////
+
+bool Identify::Prefetcher::ringSetup(unsigned entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ring = (int) syscall(__NR_io_uring_setup, entries, &p);
+    if (ring < 0)
+    {
+        LOG_DEBUG("Prefetcher: io_uring_setup failed (%s); using threads", strerror(errno));
+        return false;
+    }
+
+    // the ops we need arrived in 5.6, along with IORING_REGISTER_PROBE itself
+    const unsigned OPS = 256;
+    vector<char> probeBuffer(sizeof(struct io_uring_probe) + OPS * sizeof(struct io_uring_probe_op), 0);
+    struct io_uring_probe* probe = reinterpret_cast<struct io_uring_probe*>(probeBuffer.data());
+    if (syscall(__NR_io_uring_register, ring, IORING_REGISTER_PROBE, probe, OPS) < 0 ||
+        probe->last_op < IORING_OP_READ ||
+        !(probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED) ||
+        !(probe->ops[IORING_OP_READ  ].flags & IO_URING_OP_SUPPORTED))
+    {
+        LOG_DEBUG("Prefetcher: io_uring lacks OPENAT/READ; using threads");
+        ringTeardown();
+        return false;
+    }
+
+    sqRingBytes = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqRingBytes = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        sqRingBytes = cqRingBytes = std::max(sqRingBytes, cqRingBytes);
+    sqesBytes = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    sqRing = mmap(nullptr, sqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED)
+        sqRing = nullptr;
+    cqRing = (p.features & IORING_FEAT_SINGLE_MMAP) ? sqRing
+           : mmap(nullptr, cqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+    if (cqRing == MAP_FAILED)
+        cqRing = nullptr;
+    sqes = mmap(nullptr, sqesBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+        sqes = nullptr;
+    if (!sqRing || !cqRing || !sqes)
+    {
+        LOG_DEBUG("Prefetcher: unable to map io_uring; using threads");
+        ringTeardown();
+        return false;
+    }
+
+    char* sq = static_cast<char*>(sqRing);
+    char* cq = static_cast<char*>(cqRing);
+    sqHead  = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    sqTail  = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sqMask  = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    cqHead  = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cqTail  = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cqMask  = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes    = cq + p.cq_off.cqes;
+
+    LOG_DEBUG("Prefetcher: io_uring with %u entries", p.sq_entries);
+    return true;
+}
+
+void Identify::Prefetcher::ringTeardown()
+{
+    if (sqes)
+        munmap(sqes, sqesBytes);
+    if (cqRing && cqRing != sqRing)
+        munmap(cqRing, cqRingBytes);
+    if (sqRing)
+        munmap(sqRing, sqRingBytes);
+    sqes = sqRing = cqRing = nullptr;
+    if (ring >= 0)
+        close(ring);
+    ring = -1;
+}
+
+//! queue the file's next step: opening it, or reading on from its length
+//! (submitted by the next ringReap)
+bool Identify::Prefetcher::ringPush(File* file, bool open)
+{
+    unsigned tail = *sqTail;
+    if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) > *sqMask)
+        return false; // full (can't happen: each file has at most one op queued)
+
+    unsigned index = tail & *sqMask;
+    struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>(sqes) + index;
+    memset(sqe, 0, sizeof(*sqe));
+    if (open)
+    {
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uint64_t) (uintptr_t) file->pathname.c_str();
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    }
+    else
+    {
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = file->fd;
+        sqe->addr = (uint64_t) (uintptr_t) (file->data + file->length);
+        sqe->len = (unsigned) std::min(file->capacity - file->length, (size_t) 0x7ffff000);
+        sqe->off = file->length;
+    }
+    sqe->user_data = (uint64_t) (uintptr_t) file;
+
+    sqArray[index] = index;
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    unsubmitted++;
+    return true;
+}
+
+//! submit whatever's queued, then handle completions (waiting for at least one if asked)
+void Identify::Prefetcher::ringReap(bool wait)
+{
+    if (unsubmitted || wait)
+    {
+        long n;
+        do
+            n = syscall(__NR_io_uring_enter, ring, unsubmitted, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        while (n < 0 && errno == EINTR);
+        if (n > 0)
+            unsubmitted -= (unsigned) n;
+    }
+
+    unsigned head = *cqHead;
+    while (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+    {
+        const struct io_uring_cqe* cqe = static_cast<const struct io_uring_cqe*>(cqes) + (head & *cqMask);
+        File* file = reinterpret_cast<File*>((uintptr_t) cqe->user_data);
+        int result = cqe->res;
+        __atomic_store_n(cqHead, ++head, __ATOMIC_RELEASE);
+        ringComplete(file, result);
+    }
+}
+
+//! advance a file after one of its ops completed
+void Identify::Prefetcher::ringComplete(File* file, int result)
+{
+    if (!file->ok)
+    {
+        // opened
+        if (result < 0)
+        {
+            file->done = true;
+            return;
+        }
+        file->ok = true;
+        file->fd = result;
+        ringPush(file, false);
+        return;
+    }
+
+    // read (until EOF, or the buffer is full)
+    if (result > 0)
+    {
+        file->length += result;
+        if (file->length < file->capacity)
+        {
+            ringPush(file, false);
+            return;
+        }
+    }
+    file->complete = result == 0;
+    file->done = true;
+    close(file->fd);
+    file->fd = -1;
+}
+
+#endif
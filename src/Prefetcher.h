@@ -0,0 +1,137 @@
+#ifndef IDENTIFY_PREFETCHER_H
+#define IDENTIFY_PREFETCHER_H
+
+#include "PathSource.h"
+#include "WorkerPool.h"
+
+#include <condition_variable>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <deque>
+#include <string>
+#include <vector>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define IDENTIFY_IO_URING
+#endif
+#endif
+
+namespace Identify
+{
+    /**
+        Reads batch inputs ahead of the parsers, so they needn't block in
+        open(2) and read(2) (which on a network mount or a cold archive take
+        longer than parsing does).
+
+        Up to 'depth' files are being opened and read at once, each into a
+        buffer from a fixed pool; next() hands them back in the source's
+        order, and release() returns the buffer once the file has been parsed
+        (in place, @see CSVParser).
+
+        On Linux the reads are queued on an io_uring (IORING_OP_OPENAT and
+        IORING_OP_READ, submitted and reaped by whichever thread calls
+        next()), so one thread keeps them all in flight.  Where io_uring isn't
+        available (older kernels, other platforms, or if asked), a WorkerPool
+        of 'depth' threads does blocking reads instead.
+
+        A file larger than its buffer isn't 'complete', and the caller should
+        map it instead.
+    */
+    class Prefetcher
+    {
+        public:
+            //! one file read (or being read) into a pool buffer
+            struct File
+            {
+                std::string pathname;
+                char* data = nullptr;
+                size_t length = 0;
+                bool ok = false;       //!< opened (an empty file is ok)
+                bool complete = false; //!< the whole file fit in the buffer
+
+                const char* begin() const { return data; }
+                const char* end() const { return data + length; }
+
+                private:
+                    friend class Prefetcher;
+                    size_t capacity = 0;
+                    int fd = -1;
+                    bool done = false; //!< nothing further to read
+            };
+
+            //! @param depth files being read at once
+            //! @param bufferBytes size of each pool buffer
+            //! @param held files the caller may hold (unreleased) at once, besides those being read
+            //! @param threads use the thread pool even if io_uring is available
+            Prefetcher(PathSource& source, unsigned depth, size_t bufferBytes, unsigned held, bool threads = false);
+            ~Prefetcher();
+
+            //! @returns the next file, in order, or nullptr when there are none left
+            File* next();
+
+            //! return a file's buffer to the pool (thread-safe)
+            void release(File* file);
+
+            //! "io_uring" or "threads"
+            const char* backend() const;
+
+            //! throughput so far, for the log
+            std::string report() const;
+
+        private:
+            Prefetcher(const Prefetcher&);            //!< not copyable
+            Prefetcher& operator=(const Prefetcher&); //!< not assignable
+
+            void fill();
+            void readBlocking(File* file);
+
+#ifdef IDENTIFY_IO_URING
+            bool ringSetup(unsigned entries);
+            void ringTeardown();
+            bool ringPush(File* file, bool open);
+            void ringReap(bool wait);
+            void ringComplete(File* file, int result);
+
+            int ring = -1;
+            unsigned* sqHead = nullptr;
+            unsigned* sqTail = nullptr;
+            unsigned* sqMask = nullptr;
+            unsigned* sqArray = nullptr;
+            unsigned* cqHead = nullptr;
+            unsigned* cqTail = nullptr;
+            unsigned* cqMask = nullptr;
+            void* sqRing = nullptr;
+            void* cqRing = nullptr;
+            void* sqes = nullptr;
+            void* cqes = nullptr;
+            size_t sqRingBytes = 0;
+            size_t cqRingBytes = 0;
+            size_t sqesBytes = 0;
+            unsigned unsubmitted = 0;
+#endif
+
+            PathSource& source;
+            unsigned depth;
+            bool exhausted = false; //!< the source has no more paths
+
+            std::vector<File> files;             //!< the pool (never resized)
+            std::vector<std::unique_ptr<char[]>> buffers;
+            std::vector<File*> idle;             //!< released, ready for reuse
+            std::deque<File*> pending;           //!< being read, in order
+
+            std::unique_ptr<WorkerPool> readers; //!< if not using io_uring
+            std::mutex lock;
+            std::condition_variable changed;     //!< a read finished, or a file was released
+
+            // statistics
+            std::chrono::steady_clock::time_point started;
+            size_t bytes = 0;
+            size_t count = 0;
+            size_t oversized = 0;
+            double stalled = 0; //!< seconds next() spent waiting for reads
+    };
+}
+
+#endif
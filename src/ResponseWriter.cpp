@@ -0,0 +1,223 @@
+#include "ResponseWriter.h"
+#include "AxisCache.h"
+
+#include "Util.h"
+
+#ifdef _WIN32
+#include <io.h>
+#define write _write
+#else
+#include <unistd.h>
+#endif
+
+#include <errno.h>
+#include <math.h>
+
+using std::mutex;
+using std::string;
+using std::vector;
+using std::lock_guard;
+
+Identify::ResponseWriter::ResponseWriter(int fd) 
+    : fd(fd)
+{
+    buffer.reserve(64 * 1024);
+}
+
+Identify::ResponseWriter::~ResponseWriter()
+{
+    flush();
+}
+
+void Identify::ResponseWriter::writeStatus(const char* status)
+{
+    lock_guard<mutex> guard(lock);
+    buffer += "{ \"Status\": \"";
+    buffer += status;
+    buffer += "\" }\n";
+}
+
+void Identify::ResponseWriter::respond(const Library& library, const StreamRequest& request)
+{
+    Budget budget;
+    budget.setTimeout(request.deadline_ms);
+
+    vector<Match> matches;
+    if (!wantsTiming(request))
+    {
+        bool complete = library.identify(request.spectrum, request.max_results, matches, &budget);
+        writeMatches(request, matches, !complete);
+        return;
+    }
+
+    Timing timing = request.timings;
+    bool complete = library.identify(request.spectrum, request.max_results, matches, &budget, &timing);
+    writeMatches(request, matches, !complete, &timing);
+}
+
+void Identify::ResponseWriter::writeMatches(const StreamRequest& request, const vector<Match>& matches, bool partial, Timing* timing)
+{
+    lock_guard<mutex> guard(lock);
+    if (timing)
+        timing->start();
+    appendPrefix(request);
+    if (partial)
+        buffer += "\"partial\": true, ";
+    buffer += "\"MatchResult\": [ ";
+    bool first = true;
+    for (auto& match : matches)
+    {
+        if (match.score < request.min_confidence)
+            continue;
+        if (!first)
+            buffer += ", ";
+        buffer += "{ \"Name\": \"";
+        buffer += match.compound->jsonName;
+        buffer += "\", \"Score\": ";
+        appendScore(buffer, match.score);
+        buffer += " }";
+        first = false;
+    }
+    buffer += first ? "]" : " ]";
+    if (timing)
+        timing->lap(timing->output);
+    if (timing && request.timing)
+        appendTiming(*timing);
+    buffer += " }\n";
+
+    if (metrics)
+        metrics->recordRequest(timing, partial);
+}
+
+void Identify::ResponseWriter::writeError(const StreamRequest& request)
+{
+    lock_guard<mutex> guard(lock);
+    appendPrefix(request);
+    buffer += "\"Error\": \"";
+    buffer += Util::jsonEscape(request.error);
+    buffer += "\", \"MatchResult\": [ ] }\n";
+    if (metrics)
+        metrics->recordError();
+}
+
+void Identify::ResponseWriter::writeSkipped(const StreamRequest& request)
+{
+    lock_guard<mutex> guard(lock);
+    appendPrefix(request);
+    buffer += "\"Status\": \"skipped\", \"MatchResult\": [ ] }\n";
+    if (metrics)
+        metrics->recordSkipped();
+}
+
+//! the request's id is echoed first, so clients can match responses which
+//! arrive out of order, followed by the id of its axis
+void Identify::ResponseWriter::appendPrefix(const StreamRequest& request)
+{
+    buffer += "{ ";
+    if (request.hasId())
+    {
+        buffer += "\"id\": ";
+        buffer += request.id;
+        buffer += ", ";
+    }
+    if (request.axis_id.size())
+    {
+        // (an unknown id is the client's own string, so it must be escaped)
+        buffer += "\"axis_id\": \"";
+        if (AxisCache::isId(request.axis_id))
+            buffer += request.axis_id;
+        else
+            buffer += Util::jsonEscape(request.axis_id);
+        buffer += "\", ";
+    }
+}
+
+//! , "Timing": { "Read": 12.3, ... } (stages in microseconds)
+void Identify::ResponseWriter::appendTiming(const Timing& t)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), ", \"Timing\": { \"Read\": %.1f, \"Parse\": %.1f, \"Boxcar\": %.1f, \"Peaks\": %.1f, "
+        "\"Scan\": %.1f, \"Output\": %.1f, \"SamplePeaks\": %d, \"CompoundsScored\": %d }",
+        t.read, t.parse, t.boxcar, t.peaks, t.scan, t.output, t.samplePeaks, t.compoundsScored);
+    buffer += buf;
+}
+
+void Identify::ResponseWriter::appendScore(string& out, float score)
+{
+    long hundredths = lround(score * 100.0);
+    if (hundredths < 0)
+    {
+        out += '-';
+        hundredths = -hundredths;
+    }
+
+    char digits[24];
+    int len = 0;
+    long whole = hundredths / 100;
+    do 
+    {
+        digits[len++] = (char)('0' + whole % 10);
+        whole /= 10;
+    } 
+    while (whole);
+    while (len)
+        out += digits[--len];
+
+    int frac = (int)(hundredths % 100);
+    if (frac)
+    {
+        out += '.';
+        out += (char)('0' + frac / 10);
+        if (frac % 10)
+            out += (char)('0' + frac % 10);
+    }
+}
+
+bool Identify::ResponseWriter::flush()
+{
+    lock_guard<mutex> guard(lock);
+    if (backlog.size())
+    {
+        // (responses must go out in order, behind what's already waiting)
+        backlog += buffer;
+        buffer.clear();
+        backlog.erase(0, writeAll(backlog.data(), backlog.size()));
+        return backlog.empty();
+    }
+    if (buffer.empty())
+        return true;
+
+    size_t written = writeAll(buffer.data(), buffer.size());
+    if (written < buffer.size())
+        backlog.assign(buffer, written, string::npos);
+    buffer.clear(); // keeps capacity
+    return backlog.empty();
+}
+
+size_t Identify::ResponseWriter::pending()
+{
+    lock_guard<mutex> guard(lock);
+    return backlog.size();
+}
+
+//! @returns bytes written (short only if a non-blocking fd is full; after an
+//!          error, the rest is dropped)
+size_t Identify::ResponseWriter::writeAll(const char* data, size_t len)
+{
+    size_t written = 0;
+    while (written < len)
+    {
+        auto n = write(fd, data + written, (unsigned) (len - written));
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            LOG_INFO("ResponseWriter: write failed (errno %d)", errno);
+            return len;
+        }
+        written += n;
+    }
+    return written;
+}
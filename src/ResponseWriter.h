@@ -0,0 +1,78 @@
+#ifndef IDENTIFY_RESPONSE_WRITER_H
+#define IDENTIFY_RESPONSE_WRITER_H
+
+#include "StreamRequest.h"
+#include "Library.h"
+#include "Metrics.h"
+
+#include <string>
+#include <vector>
+#include <mutex>
+
+namespace Identify
+{
+    /**
+        Serializes streaming responses (NDJSON) into a re-used buffer, which is
+        handed to the OS with a single write(2) per flush.
+
+        Compound names are escaped once, when the library is loaded (@see
+        LibrarySpectrum::jsonName), and scores are formatted by hand, so 
+        writing a response neither allocates (once the buffer has grown) nor 
+        goes through printf.  Safe to call from multiple threads.
+
+        If the fd is non-blocking, whatever it won't take yet is kept back
+        (@see pending), and sent ahead of anything else on the next flush.
+    */
+    class ResponseWriter
+    {
+        public:
+            //! @param fd file descriptor to write to (default stdout)
+            ResponseWriter(int fd = 1);
+            ~ResponseWriter();
+
+            //! count (and time) every response in 'metrics' from now on
+            void setMetrics(Metrics* m) { metrics = m; }
+
+            //! whether a request's stages need timing, for the response or for metrics
+            bool wantsTiming(const StreamRequest& request) const { return request.timing || metrics; }
+
+            //! { "Status": "..." }
+            void writeStatus(const char* status);
+
+            //! identify the request (within its deadline, if any) and write the result
+            void respond(const Library& library, const StreamRequest& request);
+
+            //! { "id": ..., "axis_id": ..., ["partial": true,] "MatchResult": [ { "Name": ..., "Score": ... }, ... ] [, "Timing": { ... }] }
+            //! @param timing (optional) stages so far; the output stage is added here
+            void writeMatches(const StreamRequest& request, const std::vector<Match>& matches, bool partial = false, Timing* timing = nullptr);
+
+            //! { "id": ..., "Error": ..., "MatchResult": [ ] }
+            void writeError(const StreamRequest& request);
+
+            //! { "id": ..., "Status": "skipped", "MatchResult": [ ] }
+            void writeSkipped(const StreamRequest& request);
+
+            //! write everything buffered so far
+            //! @returns false if a non-blocking fd couldn't take all of it
+            bool flush();
+
+            //! bytes kept back by a non-blocking fd
+            size_t pending();
+
+            //! append a score rounded to hundredths, in its shortest form (85.7, not 85.70)
+            static void appendScore(std::string& out, float score);
+
+        private:
+            void appendPrefix(const StreamRequest& request);
+            void appendTiming(const Timing& timing);
+            size_t writeAll(const char* data, size_t len);
+
+            int fd;
+            std::string buffer;
+            std::string backlog; //!< what the fd wouldn't take yet
+            std::mutex lock;
+            Metrics* metrics = nullptr;
+    };
+}
+
+#endif
@@ -0,0 +1,296 @@
+#include "ResultStore.h"
+#include "MappedFile.h"
+
+#include "Util.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string.h>
+
+using std::string;
+using std::vector;
+using std::mutex;
+using std::unique_lock;
+
+#define WRITE_CHUNK (1 << 20) // bytes of records buffered between writes
+
+namespace
+{
+    template <typename T> void appendRaw(string& out, T value)
+    {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    void appendBytes(string& out, const string& s)
+    {
+        uint16_t len = (uint16_t) std::min(s.size(), (size_t) 0xffff);
+        appendRaw(out, len);
+        out.append(s.data(), len);
+    }
+
+    //! bounds-checked reads from a record
+    struct Reader
+    {
+        const char* p;
+        const char* end;
+        bool ok;
+
+        template <typename T> T raw()
+        {
+            T value = T();
+            if (end - p < (long) sizeof(T))
+                ok = false;
+            else
+            {
+                memcpy(&value, p, sizeof(T));
+                p += sizeof(T);
+            }
+            return value;
+        }
+
+        string bytes()
+        {
+            uint16_t len = raw<uint16_t>();
+            if (!ok || end - p < len)
+            {
+                ok = false;
+                return string();
+            }
+            string s(p, len);
+            p += len;
+            return s;
+        }
+    };
+}
+
+Identify::ResultStore::ResultStore(const string& pathname, uint64_t parameters) :
+    pathname(pathname),
+    parameters(parameters)
+{
+    // start afresh if the file is missing, stale or damaged, and compact it
+    // if it's mostly superseded records
+    if (!load() || superseded > records.size())
+        rewrite();
+
+    out = fopen(pathname.c_str(), "ab");
+    if (!out)
+        fprintf(stderr, "unable to write results store %s\n", pathname.c_str());
+    LOG_DEBUG("ResultStore: %lu records in %s", (unsigned long) records.size(), pathname.c_str());
+}
+
+Identify::ResultStore::~ResultStore()
+{
+    if (out)
+    {
+        flush();
+        fclose(out);
+    }
+}
+
+bool Identify::ResultStore::stat(const string& pathname, Key& key)
+{
+    struct stat s;
+    if (::stat(pathname.c_str(), &s) != 0 || (s.st_mode & S_IFDIR))
+        return false;
+
+    key.size = (uint64_t) s.st_size;
+#if defined(__linux__)
+    key.mtime = (int64_t) s.st_mtim.tv_sec * 1000000000 + s.st_mtim.tv_nsec;
+#elif defined(__APPLE__)
+    key.mtime = (int64_t) s.st_mtimespec.tv_sec * 1000000000 + s.st_mtimespec.tv_nsec;
+#else
+    key.mtime = (int64_t) s.st_mtime * 1000000000;
+#endif
+    key.hash = 0;
+    return true;
+}
+
+bool Identify::ResultStore::find(const string& path, Record& record)
+{
+    unique_lock<mutex> guard(lock);
+    auto it = records.find(path);
+    if (it == records.end())
+        return false;
+    record = it->second;
+    return true;
+}
+
+void Identify::ResultStore::put(const string& path, const Record& record)
+{
+    unique_lock<mutex> guard(lock);
+    auto it = records.find(path);
+    if (it == records.end())
+        records.insert(std::make_pair(path, record));
+    else
+    {
+        it->second = record;
+        superseded++;
+    }
+
+    serialize(buffer, path, record);
+    if (buffer.size() >= WRITE_CHUNK)
+        flushLocked();
+}
+
+void Identify::ResultStore::flush()
+{
+    unique_lock<mutex> guard(lock);
+    flushLocked();
+}
+
+void Identify::ResultStore::flushLocked()
+{
+    if (out && buffer.size())
+    {
+        if (fwrite(buffer.data(), 1, buffer.size(), out) != buffer.size() || fflush(out) != 0)
+            fprintf(stderr, "unable to write results store %s\n", pathname.c_str());
+    }
+    buffer.clear();
+}
+
+//! @returns false unless every record was read from a current store
+bool Identify::ResultStore::load()
+{
+    MappedFile f(pathname);
+    if (!f.valid())
+        return false;
+
+    Reader header = { f.begin() + 4, f.end(), true };
+    bool current = f.size() >= 4 && !memcmp(f.begin(), "RIDS", 4) &&
+                   header.raw<uint32_t>() == VERSION &&
+                   header.raw<uint64_t>() == parameters && header.ok;
+    if (!current)
+    {
+        if (f.size())
+            fprintf(stderr, "results store %s is from another version; starting afresh\n", pathname.c_str());
+        return false;
+    }
+
+    const char* p = header.p;
+    while (p < f.end())
+    {
+        uint32_t bytes;
+        string path;
+        Record record;
+        if (f.end() - p < 4 || (memcpy(&bytes, p, 4), f.end() - p - 4 < (long) bytes) ||
+            !deserialize(p + 4, p + 4 + bytes, path, record))
+        {
+            // (most likely the tail of an interrupted run)
+            LOG_INFO("ResultStore: ignoring a damaged record at offset %lu", (unsigned long) (p - f.begin()));
+            return false;
+        }
+        p += 4 + bytes;
+
+        auto it = records.find(path);
+        if (it == records.end())
+            records.insert(std::make_pair(path, std::move(record)));
+        else
+        {
+            it->second = std::move(record);
+            superseded++;
+        }
+    }
+    return true;
+}
+
+//! write every current record to a new file, and replace the old one with it
+bool Identify::ResultStore::rewrite()
+{
+    string tmp = pathname + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (!f)
+        return false;
+
+    string chunk("RIDS", 4);
+    appendRaw<uint32_t>(chunk, VERSION);
+    appendRaw<uint64_t>(chunk, parameters);
+    bool ok = true;
+    for (auto& r : records)
+    {
+        serialize(chunk, r.first, r.second);
+        if (chunk.size() >= WRITE_CHUNK)
+        {
+            ok = ok && fwrite(chunk.data(), 1, chunk.size(), f) == chunk.size();
+            chunk.clear();
+        }
+    }
+    ok = ok && fwrite(chunk.data(), 1, chunk.size(), f) == chunk.size();
+    ok = fclose(f) == 0 && ok;
+
+#ifdef _WIN32
+    remove(pathname.c_str()); // (rename won't replace a file)
+#endif
+    if (!ok || rename(tmp.c_str(), pathname.c_str()) != 0)
+    {
+        remove(tmp.c_str());
+        return false;
+    }
+    superseded = 0;
+    return true;
+}
+
+void Identify::ResultStore::serialize(string& out, const string& path, const Record& record)
+{
+    size_t start = out.size();
+    appendRaw<uint32_t>(out, 0); // (length, filled in below)
+    appendBytes(out, path);
+    appendRaw<uint64_t>(out, record.key.size);
+    appendRaw<int64_t>(out, record.key.mtime);
+    appendRaw<uint64_t>(out, record.key.hash);
+    appendRaw<uint64_t>(out, record.generation);
+    appendRaw<uint32_t>(out, record.results);
+    appendRaw<uint8_t>(out, record.multi ? 1 : 0);
+    appendRaw<uint32_t>(out, (uint32_t) record.entries.size());
+    for (auto& entry : record.entries)
+    {
+        appendBytes(out, entry.name);
+        uint16_t peaks = (uint16_t) std::min(entry.peaks.size(), (size_t) 0xffff);
+        appendRaw(out, peaks);
+        out.append(reinterpret_cast<const char*>(entry.peaks.data()), peaks * sizeof(float));
+        uint8_t matches = (uint8_t) std::min(entry.matches.size(), (size_t) 0xff);
+        appendRaw(out, matches);
+        for (unsigned i = 0; i < matches; i++)
+        {
+            appendRaw<uint32_t>(out, entry.matches[i].first);
+            appendRaw<float>(out, entry.matches[i].second);
+        }
+    }
+
+    uint32_t bytes = (uint32_t) (out.size() - start - 4);
+    memcpy(&out[start], &bytes, 4);
+}
+
+bool Identify::ResultStore::deserialize(const char* p, const char* end, string& path, Record& record)
+{
+    Reader r = { p, end, true };
+    path = r.bytes();
+    record.key.size = r.raw<uint64_t>();
+    record.key.mtime = r.raw<int64_t>();
+    record.key.hash = r.raw<uint64_t>();
+    record.generation = r.raw<uint64_t>();
+    record.results = r.raw<uint32_t>();
+    record.multi = r.raw<uint8_t>() != 0;
+    uint32_t count = r.raw<uint32_t>();
+    if (!r.ok || count > (uint32_t) (end - r.p))
+        return false;
+
+    record.entries.resize(count);
+    for (auto& entry : record.entries)
+    {
+        entry.name = r.bytes();
+        uint16_t peaks = r.raw<uint16_t>();
+        if (!r.ok || (size_t) (end - r.p) < peaks * sizeof(float))
+            return false;
+        entry.peaks.resize(peaks);
+        memcpy(entry.peaks.data(), r.p, peaks * sizeof(float));
+        r.p += peaks * sizeof(float);
+        uint8_t matches = r.raw<uint8_t>();
+        for (unsigned i = 0; i < matches && r.ok; i++)
+        {
+            uint32_t index = r.raw<uint32_t>();
+            float score = r.raw<float>();
+            entry.matches.push_back(std::make_pair(index, score));
+        }
+    }
+    return r.ok && r.p == end;
+}
@@ -0,0 +1,119 @@
+#ifndef IDENTIFY_RESULT_STORE_H
+#define IDENTIFY_RESULT_STORE_H
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <stdint.h>
+#include <stdio.h>
+
+namespace Identify
+{
+    /**
+        Persistent batch results, so a re-run over a mostly unchanged archive
+        only processes what's new.
+
+        Each input file is recorded under its path, with its size, mtime and
+        a content hash, the Library::generation it was scored against, and
+        for each of its spectra the sample peaks and best matches.  On a later
+        run a file is unchanged if its size and mtime match (or, if only its
+        mtime differs, its content hash does), in which case:
+
+        - against the same library, its matches are reused as they are
+        - against a changed library (or if more results are wanted than were
+          kept), its cached peaks are re-scored, without reading the file
+
+        Sample peaks depend on the peak-finding parameters, so a store made
+        with other parameters (Library::sampleParameters) is discarded.
+
+        The file is append-only: a record is added per file processed (and a
+        later record for a path supersedes earlier ones), so an interrupted
+        run loses only its unwritten tail.  It is compacted when opened, if
+        more than half of it is superseded.
+
+        Layout (native-endian):
+
+          header: "RIDS", u32 version (1), u64 sample parameters
+          record: u32 bytes (of what follows), u16 length + path, u64 size,
+                  i64 mtime (ns), u64 hash, u64 generation, u32 results kept,
+                  u8 multi, u32 spectra, then per spectrum u16 length + name,
+                  u16 peaks, f32 peak wavenumbers, u8 matches, then per match
+                  u32 compound index and f32 score
+    */
+    class ResultStore
+    {
+        public:
+            //! what identifies one version of a file
+            struct Key
+            {
+                uint64_t size = 0;
+                int64_t mtime = 0; //!< nanoseconds (where the platform has them)
+                uint64_t hash = 0;
+            };
+
+            //! one spectrum's cached results
+            struct Entry
+            {
+                std::string name;
+                std::vector<float> peaks;
+                std::vector<std::pair<uint32_t, float>> matches; //!< compound index, score
+            };
+
+            //! one file's cached results
+            struct Record
+            {
+                Key key;
+                uint64_t generation = 0;
+                uint32_t results = 0; //!< maxResults the matches were found with
+                bool multi = false;   //!< a container (@see SpectrumContainer)
+                std::vector<Entry> entries;
+            };
+
+            ResultStore(const std::string& pathname, uint64_t parameters);
+            ~ResultStore();
+
+            //! false if the store couldn't be written (results are still produced)
+            bool valid() const { return out != nullptr; }
+
+            //! a file's size and mtime (the hash is left for the caller)
+            static bool stat(const std::string& pathname, Key& key);
+
+            //! @returns false if the path has no record (thread-safe)
+            bool find(const std::string& pathname, Record& record);
+
+            //! add or replace a path's record (thread-safe)
+            void put(const std::string& pathname, const Record& record);
+
+            //! write out appended records
+            void flush();
+
+            size_t size() const { return records.size(); }
+            const std::string& path() const { return pathname; }
+
+            static const uint32_t VERSION = 1;
+
+        private:
+            ResultStore(const ResultStore&);            //!< not copyable
+            ResultStore& operator=(const ResultStore&); //!< not assignable
+
+            bool load();
+            bool rewrite();
+            void flushLocked();
+
+            static void serialize(std::string& out, const std::string& pathname, const Record& record);
+            static bool deserialize(const char* p, const char* end, std::string& pathname, Record& record);
+
+            std::string pathname;
+            uint64_t parameters;
+            std::unordered_map<std::string, Record> records;
+            size_t superseded = 0; //!< records in the file replaced by later ones
+
+            FILE* out = nullptr;
+            std::string buffer; //!< records not yet written
+            std::mutex lock;
+    };
+}
+
+#endif
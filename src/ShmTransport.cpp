@@ -0,0 +1,376 @@
+#include "ShmTransport.h"
+#include "StreamRequestJSON.h"
+
+#include "Util.h"
+
+#include <algorithm>
+#include <chrono>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <time.h>
+#endif
+
+#include <limits.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+using std::list;
+using std::string;
+using std::vector;
+using std::atomic;
+using std::memory_order_acquire;
+using std::memory_order_release;
+using std::memory_order_relaxed;
+
+using namespace Identify::Shm;
+
+#ifdef __linux__
+
+////////////////////////////////////////////////////////////////////////////////
+// futex helpers
+////////////////////////////////////////////////////////////////////////////////
+
+//! spin briefly, then sleep in the kernel until 'word' no longer holds 'expected'
+//! (or timeoutMS elapses, so callers can notice they've been asked to stop)
+static void waitWhile(atomic<uint32_t>& word, uint32_t expected, int timeoutMS = 100)
+{
+    for (int i = 0; i < 2000; i++)
+        if (word.load(memory_order_acquire) != expected)
+            return;
+
+    struct timespec ts = { timeoutMS / 1000, (timeoutMS % 1000) * 1000000L };
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, &ts, nullptr, 0);
+}
+
+static void wake(atomic<uint32_t>& word)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+static volatile sig_atomic_t stopping = 0;
+static void onSignal(int) { stopping = 1; }
+
+////////////////////////////////////////////////////////////////////////////////
+// Lifecycle
+////////////////////////////////////////////////////////////////////////////////
+
+Identify::ShmTransport::ShmTransport(const string& name_in, bool create)
+    : name(name_in), owner(create)
+{
+    if (name.empty() || name[0] != '/')
+        name = "/" + name;
+
+    int fd = create ? shm_open(name.c_str(), O_CREAT | O_RDWR, 0600)
+                    : shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0)
+    {
+        fprintf(stderr, "unable to open shared memory %s: %s\n", name.c_str(), strerror(errno));
+        return;
+    }
+
+    if (create && ftruncate(fd, sizeof(Segment)) < 0)
+    {
+        fprintf(stderr, "unable to size shared memory %s: %s\n", name.c_str(), strerror(errno));
+        close(fd);
+        return;
+    }
+
+    void* p = mmap(nullptr, sizeof(Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+    {
+        fprintf(stderr, "unable to map shared memory %s: %s\n", name.c_str(), strerror(errno));
+        return;
+    }
+    segment = static_cast<Segment*>(p);
+
+    if (create)
+    {
+        memset(p, 0, sizeof(Segment));
+        segment->version = VERSION;
+        segment->magic.store(MAGIC, memory_order_release);
+        LOG_INFO("ShmTransport: created %s (%lu bytes)", name.c_str(), sizeof(Segment));
+    }
+    else if (segment->magic.load(memory_order_acquire) != MAGIC || segment->version != VERSION)
+    {
+        fprintf(stderr, "shared memory %s is not an identify segment (or not version %u)\n", name.c_str(), VERSION);
+        munmap(segment, sizeof(Segment));
+        segment = nullptr;
+    }
+}
+
+Identify::ShmTransport::~ShmTransport()
+{
+    if (segment)
+        munmap(segment, sizeof(Segment));
+    if (owner)
+        shm_unlink(name.c_str());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Server
+////////////////////////////////////////////////////////////////////////////////
+
+int Identify::ShmTransport::serve(const Library& library)
+{
+    if (!segment)
+        return 1;
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    printf("{ \"Status\": \"ready\", \"Shm\": \"%s\" }\n", Util::jsonEscape(name).c_str());
+    fflush(stdout);
+
+    Ring& requests = segment->requests;
+    Ring& responses = segment->responses;
+    vector<Match> matches;
+    while (!stopping)
+    {
+        uint32_t tail = requests.tail.load(memory_order_relaxed);
+        if (requests.head.load(memory_order_acquire) == tail)
+        {
+            waitWhile(requests.head, tail);
+            continue;
+        }
+
+        // identify straight out of the request slot
+        const RequestSlot& req = segment->requestSlots[tail % SLOTS];
+        bool ok = req.pixels > 0 && req.pixels <= MAX_PIXELS;
+        int maxResults = std::min(std::max(req.max_results, 0), MAX_RESULTS);
+        if (ok)
+            library.identify(req.wavenumbers, req.intensities, req.pixels, maxResults, matches);
+        else
+            matches.clear();
+
+        // wait for room in the response ring
+        uint32_t head = responses.head.load(memory_order_relaxed);
+        uint32_t freed;
+        while (!stopping && head - (freed = responses.tail.load(memory_order_acquire)) >= SLOTS)
+            waitWhile(responses.tail, freed);
+        if (stopping)
+            break;
+
+        ResponseSlot& resp = segment->responseSlots[head % SLOTS];
+        resp.id = req.id;
+        resp.error = ok ? 0 : 1;
+        resp.count = 0;
+        for (auto& match : matches)
+        {
+            if (match.score < req.min_confidence)
+                continue;
+            Result& result = resp.results[resp.count++];
+            strncpy(result.name, match.compound->name.c_str(), NAME_LEN - 1);
+            result.name[NAME_LEN - 1] = 0;
+            result.score = match.score;
+        }
+
+        responses.head.store(head + 1, memory_order_release);
+        wake(responses.head);
+
+        // only now is the request slot free for re-use
+        requests.tail.store(tail + 1, memory_order_release);
+        wake(requests.tail);
+    }
+
+    printf("{ \"Status\": \"done\" }\n");
+    fflush(stdout);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Producer
+////////////////////////////////////////////////////////////////////////////////
+
+bool Identify::ShmTransport::send(uint64_t id, const Spectrum& spectrum, int maxResults, float minConfidence)
+{
+    if (!segment || spectrum.pixels > MAX_PIXELS)
+        return false;
+
+    Ring& requests = segment->requests;
+    uint32_t head = requests.head.load(memory_order_relaxed);
+    uint32_t tail;
+    while (head - (tail = requests.tail.load(memory_order_acquire)) >= SLOTS)
+        waitWhile(requests.tail, tail);
+
+    RequestSlot& req = segment->requestSlots[head % SLOTS];
+    req.id = id;
+    req.pixels = spectrum.pixels;
+    req.max_results = maxResults;
+    req.min_confidence = minConfidence;
+    memcpy(req.wavenumbers, spectrum.wavenumbers.data(), spectrum.pixels * sizeof(float));
+    memcpy(req.intensities, spectrum.intensities.data(), spectrum.pixels * sizeof(float));
+
+    requests.head.store(head + 1, memory_order_release);
+    wake(requests.head);
+    return true;
+}
+
+bool Identify::ShmTransport::receive(ResponseSlot& response)
+{
+    if (!segment)
+        return false;
+
+    Ring& responses = segment->responses;
+    uint32_t tail = responses.tail.load(memory_order_relaxed);
+    while (responses.head.load(memory_order_acquire) == tail)
+    {
+        if (stopping)
+            return false;
+        waitWhile(responses.head, tail);
+    }
+
+    memcpy(&response, &segment->responseSlots[tail % SLOTS], sizeof(response));
+    responses.tail.store(tail + 1, memory_order_release);
+    wake(responses.tail);
+    return true;
+}
+
+//! p50/p99/max of round-trip latencies, in microseconds
+static void report(const char* label, vector<double>& us)
+{
+    if (us.empty())
+        return;
+    std::sort(us.begin(), us.end());
+    double sum = 0;
+    for (double d : us)
+        sum += d;
+    printf("%-6s %6lu requests: mean %8.1f us, p50 %8.1f us, p99 %8.1f us, max %8.1f us\n",
+        label, us.size(), sum / us.size(), us[us.size() / 2], us[(us.size() * 99) / 100], us.back());
+}
+
+//! round-trip the samples through a child "identify --streaming" over pipes
+static void benchmarkStdin(const vector<Identify::Spectrum>& samples, int iterations, const string& libraryPath, const char* argv0)
+{
+    int toChild[2], fromChild[2];
+    if (pipe(toChild) < 0 || pipe(fromChild) < 0)
+        return;
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(toChild[0], 0);
+        dup2(fromChild[1], 1);
+        close(toChild[1]);
+        close(fromChild[0]);
+        execl(argv0, argv0, "--streaming", "--library", libraryPath.c_str(), (char*) nullptr);
+        _exit(127);
+    }
+    close(toChild[0]);
+    close(fromChild[1]);
+
+    FILE* out = fdopen(toChild[1], "w");
+    FILE* in = fdopen(fromChild[0], "r");
+    char* line = nullptr;
+    size_t cap = 0;
+    if (getline(&line, &cap, in) < 0) // ready
+    {
+        fprintf(stderr, "child identify --streaming did not start\n");
+        return;
+    }
+
+    vector<string> requests;
+    for (auto& sample : samples)
+        requests.push_back(Identify::StreamRequestJSON::toJSON(sample, 1));
+
+    vector<double> latencies;
+    for (int i = 0; i < iterations; i++)
+    {
+        for (auto& request : requests)
+        {
+            auto start = std::chrono::steady_clock::now();
+            fwrite(request.data(), 1, request.size(), out);
+            fflush(out);
+            if (getline(&line, &cap, in) < 0)
+                break;
+            latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+        }
+    }
+    report("stdin", latencies);
+
+    fclose(out);
+    while (getline(&line, &cap, in) >= 0)
+        ; // done
+    fclose(in);
+    free(line);
+    waitpid(pid, nullptr, 0);
+}
+
+int Identify::ShmTransport::produce(const string& name, const list<const char*>& files, int iterations,
+                                    const string& libraryPath, const char* argv0)
+{
+    ShmTransport transport(name, false);
+    if (!transport.isValid())
+        return 1;
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    vector<Spectrum> samples;
+    for (auto& pathname : files)
+    {
+        Spectrum spectrum(pathname);
+        if (spectrum.pixels > 0 && spectrum.pixels <= MAX_PIXELS)
+            samples.push_back(spectrum);
+        else
+            fprintf(stderr, "skipping %s (%d pixels)\n", pathname, spectrum.pixels);
+    }
+    if (samples.empty())
+        return 1;
+
+    vector<double> latencies;
+    ResponseSlot response;
+    uint64_t id = 0;
+    for (int i = 0; i < iterations && !stopping; i++)
+    {
+        for (auto& sample : samples)
+        {
+            auto start = std::chrono::steady_clock::now();
+            if (!transport.send(id, sample, 1, 0) || !transport.receive(response))
+                break;
+            latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+
+            if (i == 0)
+            {
+                if (response.count > 0)
+                    printf("sample %s: matched library %s with score %.2f\n", sample.name.c_str(), response.results[0].name, response.results[0].score);
+                else
+                    printf("sample %s: NO MATCH\n", sample.name.c_str());
+            }
+            id++;
+        }
+    }
+    report("shm", latencies);
+
+    if (libraryPath.size())
+        benchmarkStdin(samples, iterations, libraryPath, argv0);
+    return 0;
+}
+
+#else
+
+Identify::ShmTransport::ShmTransport(const string& name, bool create) : name(name), owner(false) 
+{
+    fprintf(stderr, "shared-memory transport is only supported on Linux\n");
+}
+Identify::ShmTransport::~ShmTransport() {}
+int Identify::ShmTransport::serve(const Library& library) { return 1; }
+bool Identify::ShmTransport::send(uint64_t id, const Spectrum& spectrum, int maxResults, float minConfidence) { return false; }
+bool Identify::ShmTransport::receive(ResponseSlot& response) { return false; }
+int Identify::ShmTransport::produce(const string& name, const list<const char*>& files, int iterations,
+                                    const string& libraryPath, const char* argv0) 
+{
+    fprintf(stderr, "shared-memory transport is only supported on Linux\n");
+    return 1;
+}
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef IDENTIFY_SHM_TRANSPORT_H
+#define IDENTIFY_SHM_TRANSPORT_H
+
+#include "Library.h"
+#include "Spectrum.h"
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <list>
+
+#include <stdint.h>
+
+namespace Identify
+{
+    /**
+        Layout of the POSIX shared-memory segment used by ShmTransport.
+
+        Everything is fixed-size plain-old-data, so a co-located acquisition
+        process (in any language) can map the same segment and exchange float32 
+        spectra with identify without serializing them to text.  Each direction
+        is a single-producer, single-consumer ring whose head and tail double as
+        futex words.
+    */
+    namespace Shm
+    {
+        const uint32_t MAGIC       = 0x52494453; //!< "RIDS"
+        const uint32_t VERSION     = 1;
+        const uint32_t SLOTS       = 8;          //!< per ring (power of two)
+        const int      MAX_PIXELS  = 4096;
+        const int      MAX_RESULTS = 16;
+        const int      NAME_LEN    = 96;         //!< including terminating null
+
+        struct Ring
+        {
+            std::atomic<uint32_t> head;     //!< next slot the producer will fill
+            char pad1[60];
+            std::atomic<uint32_t> tail;     //!< next slot the consumer will read
+            char pad2[60];
+        };
+
+        struct RequestSlot
+        {
+            uint64_t id;                    //!< chosen by the producer, echoed in the response
+            int32_t  pixels;
+            int32_t  max_results;
+            float    min_confidence;
+            uint32_t reserved;
+            float    wavenumbers[MAX_PIXELS];
+            float    intensities[MAX_PIXELS];
+        };
+
+        struct Result
+        {
+            char     name[NAME_LEN];        //!< truncated if longer
+            float    score;
+        };
+
+        struct ResponseSlot
+        {
+            uint64_t id;
+            int32_t  count;                 //!< valid entries in results
+            int32_t  error;                 //!< non-zero if the request was rejected
+            Result   results[MAX_RESULTS];
+        };
+
+        struct Segment
+        {
+            std::atomic<uint32_t> magic;    //!< set last, once the segment is initialized
+            uint32_t version;
+            char pad[56];
+            Ring requests;
+            Ring responses;
+            RequestSlot requestSlots[SLOTS];
+            ResponseSlot responseSlots[SLOTS];
+        };
+    }
+
+    /**
+        Shared-memory transport for co-located acquisition.
+
+        identify creates the segment and answers requests straight out of the
+        request slots (no copies); a producer attaches to it, fills request
+        slots and waits for response slots.  Linux only.
+    */
+    class ShmTransport
+    {
+        public:
+            //! @param create true for the server, which owns (and unlinks) the segment
+            ShmTransport(const std::string& name, bool create);
+            ~ShmTransport();
+
+            bool isValid() const { return segment != nullptr; }
+
+            //! server: answer requests until SIGINT or SIGTERM
+            //! @returns process exit code
+            int serve(const Library& library);
+
+            //! producer: queue one spectrum (blocks while the request ring is full)
+            bool send(uint64_t id, const Spectrum& spectrum, int maxResults, float minConfidence);
+
+            //! producer: wait for the next response
+            bool receive(Shm::ResponseSlot& response);
+
+            /**
+                Local producer stand-in: send each sample 'iterations' times
+                through the segment and report round-trip latency.  If a library 
+                is given, the same requests are also sent through the stdin path 
+                of a child "identify --streaming" for comparison.
+
+                @returns process exit code
+            */
+            static int produce(const std::string& name, const std::list<const char*>& files, int iterations,
+                               const std::string& libraryPath, const char* argv0);
+
+        private:
+            std::string name;
+            bool owner;
+            Shm::Segment* segment = nullptr;
+    };
+}
+
+#endif
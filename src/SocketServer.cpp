@@ -0,0 +1,479 @@
+#include "SocketServer.h"
+
+#include "StreamRequestJSON.h"
+#include "ResponseWriter.h"
+#include "Util.h"
+
+#include <vector>
+#include <thread>
+#include <deque>
+#include <mutex>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <signal.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+using std::map;
+using std::mutex;
+using std::deque;
+using std::string;
+using std::vector;
+using std::shared_ptr;
+using std::lock_guard;
+
+#define MAX_LINE    (4 << 20)  // longest request line a client may send
+#define MAX_QUEUED  64         // lines queued for a client before we stop reading its socket
+#define MAX_BACKLOG (16 << 20) // most response bytes queued for a client not reading them
+
+//! per-client state, shared between the event loop and the jobs working on it
+struct Identify::SocketServer::Connection
+{
+    int fd;
+    ResponseWriter writer;
+
+    string input;           //!< bytes received after the last complete line (event loop only)
+
+    mutex lock;             //!< guards everything below
+    deque<string> lines;    //!< complete lines not yet handled
+    bool draining = false;  //!< a job is working through 'lines'
+    bool eof = false;       //!< the client has stopped sending
+    bool failed = false;    //!< a bad request ended the session; drop the rest
+    bool done = false;      //!< final status has been sent
+    bool paused = false;    //!< MAX_QUEUED requests are waiting, so stop reading
+    bool blocked = false;   //!< responses are queued, waiting for EPOLLOUT
+    uint32_t events = 0;    //!< what the event loop is waiting for
+    int inFlight = 0;       //!< requests with ids still being identified
+
+    Connection(int fd) : fd(fd), writer(fd) {}
+    ~Connection()
+    {
+        writer.flush();
+#ifdef __linux__
+        close(fd);
+#endif
+    }
+};
+
+Identify::SocketServer::SocketServer(const Library& library, WorkerPool& pool)
+    : library(library), pool(pool)
+{
+}
+
+Identify::SocketServer::~SocketServer()
+{
+#ifdef __linux__
+    if (epollFd >= 0)
+        close(epollFd);
+#endif
+}
+
+#ifdef __linux__
+
+//! written from the signal handler to wake the event loop
+static int stopFd = -1;
+
+static void onSignal(int)
+{
+    uint64_t one = 1;
+    ssize_t ignored = write(stopFd, &one, sizeof(one));
+    (void) ignored;
+}
+
+int Identify::SocketServer::listen(const string& path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "socket path too long: %s\n", path.c_str());
+        return 1;
+    }
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(path.c_str());
+    if (listenFd < 0 || bind(listenFd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || ::listen(listenFd, SOMAXCONN) < 0)
+    {
+        fprintf(stderr, "unable to listen on %s: %s\n", path.c_str(), strerror(errno));
+        return 1;
+    }
+
+    // clients that vanish mid-response must not take the server with them
+    signal(SIGPIPE, SIG_IGN);
+
+    stopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = listenFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev);
+    ev.data.fd = stopFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, stopFd, &ev);
+
+    LOG_INFO("SocketServer: listening on %s", path.c_str());
+    printf("{ \"Status\": \"listening\", \"Path\": \"%s\" }\n", Util::jsonEscape(path).c_str());
+    fflush(stdout);
+
+    bool running = true;
+    struct epoll_event events[64];
+    while (running)
+    {
+        int n = epoll_wait(epollFd, events, 64, -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            LOG_INFO("SocketServer: epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            int fd = events[i].data.fd;
+            if (fd == stopFd)
+            {
+                LOG_INFO("SocketServer: stopping");
+                running = false;
+            }
+            else if (fd == listenFd)
+            {
+                int clientFd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+                if (clientFd < 0)
+                    continue;
+
+                shared_ptr<Connection> conn(new Connection(clientFd));
+                connections[clientFd] = conn;
+                ev.events = conn->events = EPOLLIN;
+                ev.data.fd = clientFd;
+                epoll_ctl(epollFd, EPOLL_CTL_ADD, clientFd, &ev);
+                LOG_INFO("SocketServer: client %d connected (%lu total)", clientFd, connections.size());
+
+                conn->writer.writeStatus("ready");
+                flush(conn);
+            }
+            else 
+            {
+                auto it = connections.find(fd);
+                if (it == connections.end())
+                    continue;
+                shared_ptr<Connection> conn = it->second;
+                if (events[i].events & EPOLLOUT)
+                    flush(conn);
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                    onReadable(conn);
+            }
+        }
+    }
+
+    // let in-flight requests finish, then say goodbye
+    pool.wait();
+    for (auto& it : connections)
+    {
+        {
+            lock_guard<mutex> guard(it.second->lock);
+            it.second->eof = true;
+        }
+        finish(it.second);
+    }
+    connections.clear();
+
+    close(listenFd);
+    close(stopFd);
+    unlink(path.c_str());
+    return 0;
+}
+
+//! read what the client has sent, and queue any complete lines
+void Identify::SocketServer::onReadable(shared_ptr<Connection> conn)
+{
+    char buf[64 * 1024];
+    ssize_t n = read(conn->fd, buf, sizeof(buf));
+    if (n < 0 && (errno == EINTR || errno == EAGAIN))
+        return;
+
+    bool hangup = n <= 0;
+    if (hangup)
+    {
+        LOG_INFO("SocketServer: client %d disconnected", conn->fd);
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, conn->fd, nullptr);
+        connections.erase(conn->fd);
+
+        // a final request needn't end in a linefeed
+        if (conn->input.size())
+            conn->input += '\n';
+    }
+    else
+        conn->input.append(buf, n);
+
+    size_t start = 0;
+    size_t newline;
+    {
+        lock_guard<mutex> guard(conn->lock);
+        while ((newline = conn->input.find('\n', start)) != string::npos)
+        {
+            if (!conn->failed)
+                conn->lines.push_back(conn->input.substr(start, newline - start));
+            start = newline + 1;
+        }
+        conn->input.erase(0, start);
+        conn->eof = hangup;
+
+        // leave the rest in the socket until the workers catch up
+        if (!hangup && backlog(*conn) >= MAX_QUEUED && !conn->paused)
+        {
+            conn->paused = true;
+            watch(*conn);
+        }
+
+        if (conn->input.size() > MAX_LINE)
+        {
+            LOG_INFO("SocketServer: client %d sent a line of over %d bytes; dropping it", conn->fd, MAX_LINE);
+            conn->input.clear();
+            conn->eof = conn->failed = true;
+            shutdown(conn->fd, SHUT_RDWR); // (so we'll read the hangup next)
+            return;
+        }
+
+        bool startDrain = !conn->draining && !conn->lines.empty();
+        if (startDrain)
+            conn->draining = true;
+        else if (!hangup)
+            return;
+
+        if (startDrain)
+            pool.submit([this, conn]() { drain(conn); });
+    }
+
+    if (hangup)
+        finish(conn);
+}
+
+/**
+    Handle a client's queued lines in order, on a worker.  Only one drain job
+    runs per client at a time, which is what keeps responses to requests 
+    without ids in order.
+*/
+void Identify::SocketServer::drain(shared_ptr<Connection> conn)
+{
+    while (true)
+    {
+        string line;
+        {
+            lock_guard<mutex> guard(conn->lock);
+            if (conn->lines.empty() || conn->failed)
+            {
+                conn->lines.clear();
+                conn->draining = false;
+                break;
+            }
+            line.swap(conn->lines.front());
+            conn->lines.pop_front();
+            resume(*conn);
+        }
+
+        shared_ptr<StreamRequestJSON> request(new StreamRequestJSON(line));
+        if (!request->valid && request->error.size())
+        {
+            conn->writer.writeError(*request);
+        }
+        else if (!request->valid || request->isQuit)
+        {
+            // as on stdin, a bad request ends the session
+            LOG_DEBUG("SocketServer: bad request from client %d", conn->fd);
+            lock_guard<mutex> guard(conn->lock);
+            conn->eof = conn->failed = true;
+        }
+        else if (request->hasId())
+        {
+            {
+                lock_guard<mutex> guard(conn->lock);
+                conn->inFlight++;
+            }
+            pool.submit([this, conn, request]()
+            {
+                conn->writer.respond(library, *request);
+                bool idle;
+                {
+                    lock_guard<mutex> guard(conn->lock);
+                    idle = --conn->inFlight == 0;
+                    resume(*conn);
+                }
+                if (idle)
+                    flush(conn); // (or the drain job will, if it's still going)
+                finish(conn);
+            });
+        }
+        else
+            conn->writer.respond(library, *request);
+    }
+    flush(conn);
+    finish(conn);
+}
+
+/**
+    Send a client's responses, as far as its socket will take them.  While
+    any are left over, the event loop also waits for the socket to become
+    writable, and calls this again.  Thread-safe.
+*/
+void Identify::SocketServer::flush(shared_ptr<Connection> conn)
+{
+    lock_guard<mutex> guard(conn->lock);
+    bool blocked = !conn->writer.flush();
+    if (blocked && conn->writer.pending() > MAX_BACKLOG)
+    {
+        LOG_INFO("SocketServer: client %d isn't reading its responses; dropping it", conn->fd);
+        conn->eof = conn->failed = true;
+        shutdown(conn->fd, SHUT_RDWR);
+        return;
+    }
+
+    conn->blocked = blocked;
+    watch(*conn);
+
+    // the final status is out, so hang up (which wakes the event loop, as
+    // read returns 0, if it is still watching this client)
+    if (!blocked && conn->done)
+        shutdown(conn->fd, SHUT_RDWR);
+}
+
+//! requests from a client not yet answered: queued lines, and those with ids
+//! still being identified (with conn.lock held)
+size_t Identify::SocketServer::backlog(const Connection& conn)
+{
+    return conn.lines.size() + conn.inFlight;
+}
+
+//! read from a paused client again once its backlog is down to half of
+//! MAX_QUEUED (with conn.lock held)
+void Identify::SocketServer::resume(Connection& conn)
+{
+    if (conn.paused && backlog(conn) < MAX_QUEUED / 2)
+    {
+        conn.paused = false;
+        watch(conn);
+    }
+}
+
+//! wait for the client's socket to be readable unless it's paused, and
+//! writable while it's blocked (with conn.lock held)
+void Identify::SocketServer::watch(Connection& conn)
+{
+    uint32_t events = (conn.paused ? 0u : (uint32_t) EPOLLIN) | (conn.blocked ? (uint32_t) EPOLLOUT : 0u);
+    if (events == conn.events)
+        return;
+    conn.events = events;
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = conn.fd;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, conn.fd, &ev); // (fails harmlessly once it's hung up)
+}
+
+//! once a client has stopped sending and every answer is out, say "done"
+void Identify::SocketServer::finish(shared_ptr<Connection> conn)
+{
+    {
+        lock_guard<mutex> guard(conn->lock);
+        if (!conn->eof || conn->draining || conn->inFlight > 0 || conn->done)
+            return;
+        conn->done = true;
+    }
+    conn->writer.writeStatus("done");
+    flush(conn);
+}
+
+int Identify::SocketServer::connect(const string& path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || ::connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+    {
+        fprintf(stderr, "unable to connect to %s: %s\n", path.c_str(), strerror(errno));
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    // requests: stdin -> server, then half-close so the server knows we're done
+    std::thread sender([fd]()
+    {
+        char buf[64 * 1024];
+        ssize_t n;
+        while ((n = read(0, buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR))
+        {
+            for (ssize_t sent = 0; n > 0 && sent < n; )
+            {
+                ssize_t m = write(fd, buf + sent, n - sent);
+                if (m < 0 && errno == EINTR)
+                    continue;
+                if (m < 0)
+                    return;
+                sent += m;
+            }
+        }
+        shutdown(fd, SHUT_WR);
+    });
+
+    // responses: server -> stdout, until the server hangs up
+    char buf[64 * 1024];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR))
+    {
+        for (ssize_t written = 0; n > 0 && written < n; )
+        {
+            ssize_t m = write(1, buf + written, n - written);
+            if (m < 0 && errno == EINTR)
+                continue;
+            if (m < 0)
+                break;
+            written += m;
+        }
+    }
+
+    // the server may hang up early (e.g. after a bad request) while we're 
+    // still blocked reading stdin
+    sender.detach();
+    close(fd);
+    return 0;
+}
+
+#else
+
+int Identify::SocketServer::listen(const string& path)
+{
+    fprintf(stderr, "--listen is only supported on Linux\n");
+    return 1;
+}
+
+int Identify::SocketServer::connect(const string& path)
+{
+    fprintf(stderr, "--connect is only supported on Linux\n");
+    return 1;
+}
+
+void Identify::SocketServer::onReadable(shared_ptr<Connection> conn) {}
+void Identify::SocketServer::drain(shared_ptr<Connection> conn) {}
+void Identify::SocketServer::flush(shared_ptr<Connection> conn) {}
+void Identify::SocketServer::watch(Connection& conn) {}
+void Identify::SocketServer::finish(shared_ptr<Connection> conn) {}
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef IDENTIFY_SOCKET_SERVER_H
+#define IDENTIFY_SOCKET_SERVER_H
+
+#include "Library.h"
+#include "WorkerPool.h"
+
+#include <string>
+#include <memory>
+#include <map>
+
+namespace Identify
+{
+    /**
+        Serves the --streaming NDJSON protocol over a local (Unix-domain) socket,
+        so that many clients can share one resident Library.
+
+        A single thread runs an epoll loop which accepts clients and splits 
+        their input into lines.  Each client's lines are then handled on the
+        WorkerPool exactly as the stdin loop handles them: requests without an
+        id are answered in order, requests with an id as soon as they finish.
+
+        Clients' sockets are non-blocking, so a client slow to read its
+        responses only delays itself: what its socket won't take is queued,
+        and sent as it becomes writable.  A client whose queue grows past
+        MAX_BACKLOG, or which sends a line longer than MAX_LINE, is dropped.
+        Likewise a client sending faster than it is answered is left unread
+        while MAX_QUEUED of its lines are waiting.
+
+        Linux only.
+    */
+    class SocketServer
+    {
+        public:
+            SocketServer(const Library& library, WorkerPool& pool);
+            ~SocketServer();
+
+            //! serve clients on 'path' until SIGINT or SIGTERM
+            //! @returns process exit code
+            int listen(const std::string& path);
+
+            //! relay stdin to a server on 'path', and its responses to stdout
+            //! @returns process exit code
+            static int connect(const std::string& path);
+
+        private:
+            struct Connection;
+
+            void onReadable(std::shared_ptr<Connection> conn);
+            void drain(std::shared_ptr<Connection> conn);
+            void flush(std::shared_ptr<Connection> conn);
+            static size_t backlog(const Connection& conn);
+            void resume(Connection& conn);
+            void watch(Connection& conn);
+            void finish(std::shared_ptr<Connection> conn);
+
+            const Library& library;
+            WorkerPool& pool;
+            int epollFd = -1;
+            std::map<int, std::shared_ptr<Connection>> connections;
+    };
+}
+
+#endif
@@ -21,10 +21,13 @@ Identify::Spectrum::Spectrum(const string& pathname_in) :
     if (parser.isValid())
     {
         name = parser.getName();
-        wavenumbers = parser.wavenumbers;
-        intensities = parser.intensities;
+        wavenumbers.swap(parser.wavenumbers);
+        if (parser.isMulti())
+            intensities.swap(parser.columns[0]); // a lone Spectrum takes the first measurement
+        else
+            intensities.swap(parser.intensities);
         pixels = wavenumbers.size();
-        Util::log("loaded %s (%d pixels)", name.c_str(), pixels);
+        LOG_DEBUG("loaded %s (%d pixels)", name.c_str(), pixels);
     }
 }
 
@@ -0,0 +1,121 @@
+#include "SpectrumContainer.h"
+#include "CSVParser.h"
+
+#include "Util.h"
+
+#include <string.h>
+#include <stdio.h>
+
+using std::string;
+using std::vector;
+
+Identify::SpectrumContainer::SpectrumContainer(const string& pathname) :
+    pathname(pathname),
+    file(pathname)
+{
+    load(file.begin(), file.end());
+}
+
+Identify::SpectrumContainer::SpectrumContainer(const string& pathname, const char* begin, const char* end) :
+    pathname(pathname)
+{
+    load(begin, end);
+}
+
+void Identify::SpectrumContainer::load(const char* begin, const char* end)
+{
+    contents = begin;
+    length = end - begin;
+    if (!loadBinary(begin, end))
+        loadCSV(begin, end);
+}
+
+string Identify::SpectrumContainer::path(const string& pathname, bool multi, size_t i)
+{
+    return multi ? Util::sprintf("%s#%lu", pathname.c_str(), (unsigned long) i) : pathname;
+}
+
+uint64_t Identify::SpectrumContainer::hash() const
+{
+    return Util::hash(contents, length);
+}
+
+bool Identify::SpectrumContainer::loadBinary(const char* begin, const char* end)
+{
+    const char* p = begin;
+    size_t size = end - begin;
+    if (size < 16 || memcmp(p, "RSPC", 4))
+        return false;
+
+    multi = true;
+    uint32_t version, count, n;
+    memcpy(&version, p +  4, 4);
+    memcpy(&n,       p +  8, 4);
+    memcpy(&count,   p + 12, 4);
+    if (version != VERSION || n == 0 || n > (uint32_t) (size / sizeof(float)))
+    {
+        fprintf(stderr, "%s: unsupported spectrum container (version %u, %u pixels)\n", pathname.c_str(), version, n);
+        return true;
+    }
+    pixels = (int) n;
+    size_t bytes = pixels * sizeof(float);
+
+    p += 16;
+    if (end - p < (long) bytes)
+        return true;
+    wavenumbers = reinterpret_cast<const float*>(p);
+    p += bytes;
+
+    while (end - p >= 2 && (count == 0 || entries.size() < count))
+    {
+        uint16_t len;
+        memcpy(&len, p, 2);
+        const char* name = p + 2;
+        size_t offset = (name + len) - begin;
+        const char* data = begin + ((offset + 3) & ~(size_t) 3);
+        if (data > end || end - data < (long) bytes)
+        {
+            fprintf(stderr, "%s: truncated after %lu spectra\n", pathname.c_str(), (unsigned long) entries.size());
+            break;
+        }
+
+        Entry entry;
+        entry.name.assign(name, len);
+        entry.intensities = reinterpret_cast<const float*>(data);
+        entries.push_back(entry);
+        p = data + bytes;
+    }
+    return true;
+}
+
+void Identify::SpectrumContainer::loadCSV(const char* begin, const char* end)
+{
+    // an unreadable file is an empty spectrum (named by its path), as before
+    CSVParser parser(pathname, begin, end);
+    if (!parser.isValid())
+    {
+        entries.push_back(Entry { Util::basename(pathname), nullptr });
+        return;
+    }
+
+    axis.swap(parser.wavenumbers);
+    wavenumbers = axis.data();
+    pixels = (int) axis.size();
+
+    if (!parser.isMulti())
+    {
+        columns.resize(1);
+        columns[0].swap(parser.intensities);
+        entries.push_back(Entry { parser.getName(), columns[0].data() });
+        return;
+    }
+
+    multi = true;
+    columns.swap(parser.columns);
+    for (size_t i = 0; i < columns.size(); i++)
+    {
+        string name = i < parser.labels.size() && parser.labels[i].size() ? parser.labels[i]
+                                                                           : Util::sprintf("%s#%lu", parser.getName().c_str(), (unsigned long) i);
+        entries.push_back(Entry { name, columns[i].data() });
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef IDENTIFY_SPECTRUM_CONTAINER_H
+#define IDENTIFY_SPECTRUM_CONTAINER_H
+
+#include "MappedFile.h"
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+namespace Identify
+{
+    /**
+        Every spectrum in one batch input file, sharing one wavenumber axis:
+
+        - a CSV of one measurement (as Spectrum would read it)
+        - an ENLIGHTEN multi-column export (@see CSVParser::columns)
+        - a binary container, which is read in place from the mapping:
+
+          header:   "RSPC", u32 version (1), u32 pixels, u32 count (0 = as
+                    many as the file holds, so spectra may be appended)
+          axis:     f32 wavenumbers[pixels]
+          spectrum: u16 name length, name, zero padding to a 4-byte offset,
+                    f32 intensities[pixels]
+
+          All values are native-endian (little-endian on x86 and ARM).
+
+        Either way the file is opened and mapped once, and its axis parsed
+        once, however many spectra it holds.
+    */
+    class SpectrumContainer
+    {
+        public:
+            //! one measurement
+            struct Entry
+            {
+                std::string name;
+                const float* intensities;
+            };
+
+            SpectrumContainer(const std::string& pathname);
+
+            //! a file already in memory (which must outlive the container)
+            SpectrumContainer(const std::string& pathname, const char* begin, const char* end);
+
+            size_t size() const { return entries.size(); }
+
+            //! the path to report for an entry ("file#i" within a container)
+            std::string path(size_t i) const { return path(pathname, multi, i); }
+            static std::string path(const std::string& pathname, bool multi, size_t i);
+
+            //! Util::hash of the file's contents
+            uint64_t hash() const;
+
+            std::string pathname;
+            bool multi = false;                //!< holds (or could hold) several spectra
+            int pixels = 0;
+            const float* wavenumbers = nullptr;
+            std::vector<Entry> entries;
+
+            static const uint32_t VERSION = 1;
+
+        private:
+            void load(const char* begin, const char* end);
+            bool loadBinary(const char* begin, const char* end);
+            void loadCSV(const char* begin, const char* end);
+
+            MappedFile file;
+            const char* contents = nullptr; //!< (mapped, or the caller's)
+            size_t length = 0;
+            std::vector<float> axis;                 //!< CSVs' parsed storage
+            std::vector<std::vector<float>> columns;
+    };
+}
+
+#endif
@@ -4,12 +4,32 @@
 
 using std::istream;
 
+Identify::StreamRequest::StreamRequest()
+{
+    LOG_TRACE("creating StreamRequest");
+}
+
 Identify::StreamRequest::StreamRequest(istream& is)
 {
-    Util::log("creating StreamRequest");
+    LOG_TRACE("creating StreamRequest");
 }
 
 Identify::StreamRequest::~StreamRequest()
 {
-    Util::log("destroying StreamRequest");
+    LOG_TRACE("destroying StreamRequest");
+}
+
+bool Identify::StreamRequest::reload(istream& is)
+{
+    id.clear();
+    axis_id.clear();
+    error.clear();
+    min_confidence = 0;
+    max_results = 20;
+    deadline_ms = 0;
+    timing = false;
+    timings = Timing();
+    isQuit = false;
+    valid = load(is);
+    return valid;
 }
@@ -2,6 +2,7 @@
 #define IDENTIFY_STREAM_REQUEST_H
 
 #include "Spectrum.h"
+#include "Timing.h"
 
 #include <string>
 #include <vector>
@@ -12,15 +13,28 @@ namespace Identify
     class StreamRequest
     {
         public:
+            StreamRequest();
             StreamRequest(std::istream& infile);
             virtual ~StreamRequest();
 
             Spectrum spectrum;
+            std::string id;         //!< optional client token, echoed verbatim in the response
+            std::string axis_id;    //!< hash of the wavenumber axis (@see AxisCache)
+            std::string error;      //!< set when a request is rejected but the stream can continue
             float min_confidence = 0;
             int max_results = 20;
+            int deadline_ms = 0;    //!< latency budget for identification (0 = none)
+            bool timing = false;    //!< report a per-stage Timing breakdown in the response
+            Timing timings;         //!< read and parse stages, filled in by the loader
             bool isQuit = false;
             bool valid = false;
 
+            //! re-populate this request from the next input, re-using its buffers
+            bool reload(std::istream& infile);
+
+            //! requests carrying an id may be answered out of order
+            bool hasId() const { return id.size() > 0; }
+
         protected:
             // abstract method
             virtual bool load(std::istream& infile) = 0;
@@ -7,28 +7,93 @@
 using namespace simdjson;
 
 using std::string;
+using std::vector;
 using std::istream;
 
-ondemand::parser Identify::StreamRequestJSON::parser;
+thread_local ondemand::parser Identify::StreamRequestJSON::parser;
+thread_local string Identify::StreamRequestJSON::line;
+thread_local size_t Identify::StreamRequestJSON::lastPixels = 0;
+Identify::AxisCache Identify::StreamRequestJSON::axes;
 
 Identify::StreamRequestJSON::StreamRequestJSON(istream& is)
     : Identify::StreamRequest(is)
 {
-    Util::log("instantiating StreamRequestJSON");
+    LOG_TRACE("instantiating StreamRequestJSON");
     valid = load(is);
-    Util::log("instantiated StreamRequestJSON (valid %s)", valid ? "yes" : "no");
+    LOG_TRACE("instantiated StreamRequestJSON (valid %s)", valid ? "yes" : "no");
+}
+
+Identify::StreamRequestJSON::StreamRequestJSON(string& json)
+{
+    LOG_TRACE("instantiating StreamRequestJSON");
+    timings.start();
+    valid = parse(json);
+    LOG_TRACE("instantiated StreamRequestJSON (valid %s)", valid ? "yes" : "no");
 }
 
 Identify::StreamRequestJSON::~StreamRequestJSON()
 {
-    Util::log("destroying StreamRequestJSON");
+    LOG_TRACE("destroying StreamRequestJSON");
+}
+
+string Identify::StreamRequestJSON::toJSON(const Spectrum& spectrum, int maxResults)
+{
+    string json = Util::sprintf("{\"max_results\":%d,\"spectrum\":[", maxResults);
+    for (int i = 0; i < spectrum.pixels; i++)
+        json += Util::sprintf(i ? ",%g" : "%g", spectrum.intensities[i]);
+    json += "],\"wavenumbers\":[";
+    for (int i = 0; i < spectrum.pixels; i++)
+        json += Util::sprintf(i ? ",%g" : "%g", spectrum.wavenumbers[i]);
+    json += "]}\n";
+    return json;
+}
+
+/**
+    Decode the elements of a JSON array straight into 'out'.
+
+    The vector is sized up-front (to its current length if it is being re-used,
+    else to the previous request's length) and written by index, so a typical
+    request performs at most one allocation per array and a re-used request
+    none.  On any malformed element the vector is cleared, so a rejected
+    request never leaves a partially-populated buffer behind.
+*/
+bool Identify::StreamRequestJSON::readArray(ondemand::value& value, vector<float>& out, size_t hint)
+{
+    ondemand::array array;
+    if (value.get_array().get(array))
+    {
+        out.clear();
+        return false;
+    }
+
+    if (out.size() < hint)
+        out.resize(hint);
+
+    size_t count = 0;
+    for (auto element : array)
+    {
+        double d;
+        if (element.get_double().get(d))
+        {
+            out.clear();
+            return false;
+        }
+
+        if (count < out.size())
+            out[count] = (float) d;
+        else
+            out.push_back((float) d);
+        count++;
+    }
+    out.resize(count);
+    return true;
 }
 
 bool Identify::StreamRequestJSON::load(istream& is)
 {
     if (is.eof())
     {
-        Util::log("StreamRequestJSON: EOF");
+        LOG_DEBUG("StreamRequestJSON: EOF");
         return false;
     }
 
@@ -36,68 +101,146 @@ bool Identify::StreamRequestJSON::load(istream& is)
     // read ONE LINE from input stream (i.e. an NDJSON document)
     ////////////////////////////////////////////////////////////////////////////
 
-    string json;
-    std::getline(is, json);
+    timings.start();
+    std::getline(is, line);
+    timings.lap(timings.read);
+    return parse(line);
+}
+
+bool Identify::StreamRequestJSON::parse(string& json)
+{
     if (json.size() == 0)
     {
-        Util::log("StreamRequestJSON: empty");
+        LOG_DEBUG("StreamRequestJSON: empty");
         return false;
     }
     json.reserve(json.size() + SIMDJSON_PADDING);
 
     ////////////////////////////////////////////////////////////////////////////
-    // parse JSON (create document iterator)
+    // parse JSON (walk the document's fields once, in whatever order they came)
     ////////////////////////////////////////////////////////////////////////////
 
-    ondemand::document doc = parser.iterate(json);
+    bool ok = true;
+    bool haveSpectrum = false;
+    bool haveWavenumbers = false;
 
-    // note that simdjson runs faster if keys are searched in order of 
-    // appearance, so recommend both client and server sort keys alphabetically
-
-    // max_results (optional)
-    auto max_results_obj = doc["max_results"];
-    if (NO_SUCH_FIELD == max_results_obj.error())
-        Util::log("StreamRequestJSON: missing max_results");
-    else
-        max_results = double(max_results_obj);
-
-    // min_confidence (optional)
-    auto min_confidence_obj = doc["min_confidence"];
-    if (NO_SUCH_FIELD == min_confidence_obj.error())
-        Util::log("StreamRequestJSON: missing min_confidence");
-    else
-        min_confidence = double(min_confidence_obj);
-
-    // spectrum (required)
-    auto spectrum_obj = doc["spectrum"];
-    if (NO_SUCH_FIELD == spectrum_obj.error())
+    ondemand::document doc = parser.iterate(json);
+    ondemand::object obj;
+    if (doc.get_object().get(obj))
     {
-        Util::log("StreamRequestJSON: missing spectrum");
+        LOG_DEBUG("StreamRequestJSON: not a JSON object");
         return false;
     }
-    for (auto value: spectrum_obj)
-        spectrum.intensities.push_back(double(value));
 
-    // wavenumbers (required)
-    auto wavenumbers_obj = doc["wavenumbers"];
-    if (NO_SUCH_FIELD == wavenumbers_obj.error())
+    for (auto result : obj)
     {
-        Util::log("StreamRequestJSON: missing wavenumbers");
-        return false;
+        if (!ok)
+            break;
+
+        ondemand::raw_json_string key;
+        ondemand::value value;
+        if (result.key().get(key) || result.value().get(value))
+        {
+            LOG_DEBUG("StreamRequestJSON: malformed field");
+            ok = false;
+            break;
+        }
+
+        if (key == "id")
+        {
+            // string or number: kept as its raw JSON token so it can be echoed 
+            // back without re-escaping
+            auto type = value.type();
+            if (type.error() || (type.value() != ondemand::json_type::string && type.value() != ondemand::json_type::number))
+            {
+                LOG_DEBUG("StreamRequestJSON: id must be a string or number");
+                ok = false;
+                break;
+            }
+            std::string_view token = value.raw_json_token();
+            id.assign(token.data(), token.size());
+            Util::rtrim(id);
+        }
+        else if (key == "max_results")
+        {
+            double d;
+            if ((ok = !value.get_double().get(d)))
+                max_results = (int) d;
+        }
+        else if (key == "deadline_ms")
+        {
+            double d;
+            if ((ok = !value.get_double().get(d)))
+                deadline_ms = (int) d;
+        }
+        else if (key == "timing")
+            ok = !value.get_bool().get(timing);
+        else if (key == "min_confidence")
+        {
+            double d;
+            if ((ok = !value.get_double().get(d)))
+                min_confidence = (float) d;
+        }
+        else if (key == "spectrum")
+            ok = haveSpectrum = readArray(value, spectrum.intensities, lastPixels);
+        else if (key == "wavenumbers")
+            ok = haveWavenumbers = readArray(value, spectrum.wavenumbers, lastPixels);
+        else if (key == "axis_id")
+        {
+            std::string_view sv;
+            if ((ok = !value.get_string().get(sv)))
+                axis_id.assign(sv.data(), sv.size());
+        }
+
+        if (!ok)
+            LOG_DEBUG("StreamRequestJSON: malformed value");
+    }
+
+    if (ok && !haveSpectrum)
+    {
+        LOG_DEBUG("StreamRequestJSON: missing spectrum");
+        ok = false;
+    }
+    if (ok && haveWavenumbers)
+    {
+        // explicit axis: remember it, and tell the client its id
+        axis_id = axes.add(spectrum.wavenumbers);
+    }
+    else if (ok && axis_id.size())
+    {
+        // elided axis: the client must re-send the full array if we've forgotten it
+        if (!axes.lookup(axis_id, spectrum.wavenumbers))
+        {
+            LOG_DEBUG("StreamRequestJSON: unknown axis_id %s", axis_id.c_str());
+            error = "unknown axis_id";
+            ok = false;
+        }
+    }
+    else if (ok)
+    {
+        LOG_DEBUG("StreamRequestJSON: missing wavenumbers (or axis_id)");
+        ok = false;
     }
-    for (auto value: wavenumbers_obj)
-        spectrum.wavenumbers.push_back(double(value));
 
     spectrum.pixels = spectrum.wavenumbers.size();
-    Util::log("read JSON request with %d wavenumbers (%.2f, %.2f), %d intensities, min_confidence %.2f and max_results %d",
+    ok = ok && spectrum.isValid();
+    if (!ok)
+    {
+        spectrum.intensities.clear();
+        spectrum.wavenumbers.clear();
+        spectrum.pixels = 0;
+        return false;
+    }
+    lastPixels = spectrum.pixels;
+    timings.lap(timings.parse);
+
+    LOG_DEBUG("read JSON request %s with %d wavenumbers (%.2f, %.2f), %d intensities, min_confidence %.2f and max_results %d",
+        hasId() ? id.c_str() : "(no id)",
         spectrum.pixels,
         spectrum.pixels > 0 ? spectrum.wavenumbers[        0        ] : -1,
         spectrum.pixels > 0 ? spectrum.wavenumbers[spectrum.pixels-1] : -1,
         spectrum.intensities.size(), 
         min_confidence, 
         max_results);
-
-    bool ok = spectrum.isValid();
-    Util::log("spectrum valid = %s", ok ? "yes" : "no");
-    return ok;
+    return true;
 }
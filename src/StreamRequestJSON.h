@@ -2,6 +2,7 @@
 #define IDENTIFY_STREAM_REQUEST_JSON_H
 
 #include "StreamRequest.h"
+#include "AxisCache.h"
 #include "simdjson.h"
 
 namespace Identify
@@ -10,14 +11,39 @@ namespace Identify
     {
         public:
             StreamRequestJSON(std::istream& infile);
+
+            //! parse a single NDJSON line already in memory (padding is 
+            //! reserved in place, so the string is modified)
+            StreamRequestJSON(std::string& json);
             virtual ~StreamRequestJSON();
 
+            //! the spectrum as a --streaming request line (for benchmarks)
+            static std::string toJSON(const Spectrum& spectrum, int maxResults = 20);
+
+            //! shared by all requests (e.g. for hit rates)
+            static const AxisCache& axisCache() { return axes; }
+
         private:
             virtual bool load(std::istream& infile);
+            bool parse(std::string& json);
+
+            //! decode a JSON array of numbers in place, without reallocating
+            //! when 'out' already holds (or the hint matches) its length
+            static bool readArray(simdjson::ondemand::value& value, std::vector<float>& out, size_t hint);
 
             //! for efficiency, re-use parser over multiple input requests
+            //! (one per thread, as requests may be parsed on worker threads)
             //! @see https://github.com/simdjson/simdjson/blob/master/doc/basics.md#parser-document-and-json-scope
-            static simdjson::ondemand::parser parser;
+            static thread_local simdjson::ondemand::parser parser;
+
+            //! likewise re-use the line buffer (keeps its capacity between requests)
+            static thread_local std::string line;
+
+            //! axes seen so far, so clients may send "axis_id" instead of "wavenumbers"
+            static AxisCache axes;
+
+            //! array length of the previous request, used to pre-size new buffers
+            static thread_local size_t lastPixels;
     };
 }
 
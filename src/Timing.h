@@ -0,0 +1,46 @@
+#ifndef IDENTIFY_TIMING_H
+#define IDENTIFY_TIMING_H
+
+#include <chrono>
+
+namespace Identify
+{
+    /**
+        Optional per-stage breakdown of one streamed request, reported when the
+        request sets "timing": true (or metrics are being kept).  Stages are
+        accumulated as "laps" of a monotonic clock.  Reading and parsing are
+        always timed (three clock reads per request); identification and
+        output only take laps when handed a non-null Timing, so otherwise
+        cost nothing but a pointer test.
+    */
+    struct Timing
+    {
+        typedef std::chrono::steady_clock Clock;
+
+        // microseconds per stage
+        double read = 0;    //!< reading the request line from its stream
+        double parse = 0;   //!< JSON to Spectrum
+        double boxcar = 0;  //!< smoothing the sample
+        double peaks = 0;   //!< sample peak detection
+        double scan = 0;    //!< ranking and scoring library compounds
+        double output = 0;  //!< serializing the response
+
+        int samplePeaks = 0;
+        int compoundsScored = 0;
+
+        Clock::time_point last;
+
+        //! begin timing the next stage
+        void start() { last = Clock::now(); }
+
+        //! charge the time since start() (or the previous lap) to a stage
+        void lap(double& stage)
+        {
+            Clock::time_point now = Clock::now();
+            stage += std::chrono::duration<double, std::micro>(now - last).count();
+            last = now;
+        }
+    };
+}
+
+#endif
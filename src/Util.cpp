@@ -5,9 +5,14 @@
 #endif
 
 #include "Util.h"
+#include "AsyncLog.h"
 
 #include <time.h>
+#include <ctype.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <sstream>
 #include <regex>
@@ -20,7 +25,6 @@ using std::stringstream;
 using std::regex_search;
 
 bool Util::logging_enabled = false;
-static FILE* logfile = stdout;
 
 string Util::join(const vector<float>& v, const string& delim)
 {
@@ -54,6 +58,119 @@ vector<string> Util::split(const string& s, const string& delim)
     return tok;
 }
 
+/**
+    atof() over [begin, end), which needn't be NUL-terminated, without
+    allocating.
+
+    Plain decimals of up to 15 significant digits and exponents within 10^22
+    (all a CSV of spectra normally holds) are exact in a double, so one
+    multiply or divide by an exact power of ten rounds them correctly; the
+    result is therefore identical to (float) atof().  Anything else (more
+    digits, inf, nan, hex) is handed to strtod itself.
+*/
+float Util::parseFloat(const char* begin, const char* end)
+{
+    static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+        1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+    const char* p = begin;
+    while (p < end && isspace((unsigned char) *p))
+        p++;
+
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    uint64_t mantissa = 0;
+    int digits = 0;   // significant digits in mantissa
+    int exponent = 0; // power of ten to apply to mantissa
+    bool any = false;
+    for (; p < end && '0' <= *p && *p <= '9'; p++, any = true)
+        if (mantissa || *p != '0')
+        {
+            if (++digits > 15)
+                break;
+            mantissa = mantissa * 10 + (*p - '0');
+        }
+    if (p < end && *p == '.' && digits <= 15)
+        for (p++; p < end && '0' <= *p && *p <= '9'; p++, any = true)
+        {
+            if (mantissa || *p != '0')
+                if (++digits > 15)
+                    break;
+            mantissa = mantissa * 10 + (*p - '0');
+            exponent--;
+        }
+
+    if (digits <= 15 && any && p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char* q = p + 1;
+        bool negativeExponent = false;
+        if (q < end && (*q == '-' || *q == '+'))
+            negativeExponent = *q++ == '-';
+        if (q < end && '0' <= *q && *q <= '9')
+        {
+            int e = 0;
+            for (; q < end && '0' <= *q && *q <= '9'; q++)
+                if (e < 10000)
+                    e = e * 10 + (*q - '0');
+            exponent += negativeExponent ? -e : e;
+            p = q;
+        }
+    }
+
+    bool unusual = p < end && (*p == 'x' || *p == 'X' || (!any && isalpha((unsigned char) *p)));
+    if (!any && !unusual)
+        return 0;
+
+    if (unusual || digits > 15 || exponent < -22 || exponent > 22)
+    {
+        // rare: defer to the C library on a NUL-terminated copy
+        string copy(begin, end);
+        return (float) atof(copy.c_str());
+    }
+
+    double value = (double) mantissa;
+    if (exponent < 0)
+        value /= powers[-exponent];
+    else
+        value *= powers[exponent];
+    return (float) (negative ? -value : value);
+}
+
+/**
+    A fast, non-cryptographic 64-bit hash (for recognizing unchanged files,
+    not for security): FNV-1a, but over 8-byte words rather than bytes, with
+    a final avalanche so that every input bit affects every output bit.
+    Chain calls by passing the previous result as the seed.
+*/
+uint64_t Util::hash(const void* data, size_t bytes, uint64_t seed)
+{
+    const uint64_t prime = 0x100000001b3ull;
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    uint64_t h = seed ^ bytes;
+    for (; bytes >= 8; p += 8, bytes -= 8)
+    {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        h = (h ^ word) * prime;
+    }
+    if (bytes)
+    {
+        uint64_t word = 0;
+        memcpy(&word, p, bytes);
+        h = (h ^ word) * prime;
+    }
+
+    // (the murmur3 finalizer)
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb3fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
 string Util::toLower(const string& s)
 {
     string lc(s);
@@ -62,6 +179,33 @@ string Util::toLower(const string& s)
     return lc;
 }
 
+//! @returns s with quotes, backslashes and control characters escaped (no surrounding quotes)
+string Util::jsonEscape(const string& s)
+{
+    string escaped;
+    escaped.reserve(s.size());
+    for (unsigned i = 0; i < s.size(); i++)
+    {
+        unsigned char c = s[i];
+        switch (c)
+        {
+            case '"':  escaped += "\\\""; break;
+            case '\\': escaped += "\\\\"; break;
+            case '\b': escaped += "\\b"; break;
+            case '\f': escaped += "\\f"; break;
+            case '\n': escaped += "\\n"; break;
+            case '\r': escaped += "\\r"; break;
+            case '\t': escaped += "\\t"; break;
+            default:
+                if (c < 0x20)
+                    escaped += Util::sprintf("\\u%04x", c);
+                else
+                    escaped += c;
+        }
+    }
+    return escaped;
+}
+
 string Util::sprintf(const char* fmt, ...)
 {
     char buf[256];
@@ -103,29 +247,29 @@ void Util::log_spectrum(const string& label, const vector<float>& spectrum)
     Util::log("DEBUG: %s, %s", label.c_str(), Util::join(spectrum, ", ").c_str());
 }
 
+//! queue the line for the background log writer (timestamped when written)
 void Util::log_va(const char* fmt, va_list args)
 {
-    time_t now = time(NULL);
-    string(ts) = ctime(&now);
-    ts[ts.length() - 1] = 0;
-
-    fprintf(logfile, "DEBUG: %s ", ts.c_str());
-    vfprintf(logfile, fmt, args);
-    fprintf(logfile, "\n");
-    fflush(logfile);
+    Identify::AsyncLog::write(fmt, args);
 }
 
 void Util::set_logfile(const string& pathname)
 {
     if (pathname.size() == 0)
     {
-        logfile = stdout;
+        Identify::AsyncLog::setFile(stdout);
         return;
     }
-    logfile = fopen(pathname.c_str(), "w");
+    Identify::AsyncLog::setFile(fopen(pathname.c_str(), "w"));
     log("logging to: %s", pathname.c_str());
 }
 
+//! block until every queued log line has been written
+void Util::flush_log()
+{
+    Identify::AsyncLog::flush();
+}
+
 /**
     @brief given /path/to/foo.bar.csv, returns "foo.bar"
 */
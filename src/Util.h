@@ -8,6 +8,31 @@
 #include <string>
 #include <sstream>
 
+#include <stdint.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// Logging macros
+////////////////////////////////////////////////////////////////////////////////
+
+/*! Log levels.  Statements above LOG_LEVEL are compiled out entirely (build
+    with e.g. "make LOG_LEVEL=1" to strip per-compound and per-peak tracing
+    from release builds); the rest only evaluate their arguments when
+    --verbose has enabled logging at runtime.
+*/
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_INFO  1 //!< startup, shutdown, connections and errors
+#define LOG_LEVEL_DEBUG 2 //!< once per request
+#define LOG_LEVEL_TRACE 3 //!< inner loops (per compound, per peak)
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_TRACE
+#endif
+
+#define LOG_AT(level, ...) do { if ((level) <= LOG_LEVEL && Util::logging_enabled) Util::log(__VA_ARGS__); } while (0)
+#define LOG_INFO(...)  LOG_AT(LOG_LEVEL_INFO,  __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_TRACE(...) LOG_AT(LOG_LEVEL_TRACE, __VA_ARGS__)
+
 /*! @brief Simple utility functions.
 
     @see trim functions from https://stackoverflow.com/a/217605
@@ -29,6 +54,7 @@ class Util
         static void log_spectrum(const std::string& label, const std::vector<float>& spectrum);
         static void set_logfile(const std::string& pathname);
         static void log_va(const char* fmt, va_list args);
+        static void flush_log();
 
         ////////////////////////////////////////////////////////////////////////
         // Files
@@ -37,6 +63,13 @@ class Util
         static std::string basename(const std::string& pathname);
         static std::vector<std::string> readDir(const std::string& path);
 
+        ////////////////////////////////////////////////////////////////////////
+        // Hashing
+        ////////////////////////////////////////////////////////////////////////
+
+        static const uint64_t HASH_SEED = 0xcbf29ce484222325ull;
+        static uint64_t hash(const void* data, size_t bytes, uint64_t seed = HASH_SEED);
+
         ////////////////////////////////////////////////////////////////////////
         // Strings
         ////////////////////////////////////////////////////////////////////////
@@ -47,9 +80,15 @@ class Util
         // case
         static std::string toLower(const std::string& s);
 
+        // escaping
+        static std::string jsonEscape(const std::string& s);
+
         // splitting
         static std::vector<std::string> split(const std::string& s, const std::string& delim);
 
+        // parsing
+        static float parseFloat(const char* begin, const char* end);
+
         // joining
         static std::string join(const std::vector<float>& v, const std::string& delim);
         template<typename T> static std::string join(const T& v, const std::string& delim)
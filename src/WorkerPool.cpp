@@ -0,0 +1,84 @@
+#include "WorkerPool.h"
+
+#include "Util.h"
+
+using std::mutex;
+using std::unique_lock;
+
+Identify::WorkerPool::WorkerPool(unsigned threads)
+{
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    if (threads == 0)
+        threads = 1;
+
+    LOG_INFO("WorkerPool: starting %u threads", threads);
+    for (unsigned i = 0; i < threads; i++)
+        workers.push_back(std::thread(&WorkerPool::run, this));
+}
+
+Identify::WorkerPool::~WorkerPool()
+{
+    {
+        unique_lock<mutex> guard(lock);
+        stopping = true;
+    }
+    jobReady.notify_all();
+    for (auto& t : workers)
+        t.join();
+}
+
+void Identify::WorkerPool::submit(const Job& job)
+{
+    {
+        unique_lock<mutex> guard(lock);
+        jobs.push_back(job);
+    }
+    jobReady.notify_one();
+}
+
+size_t Identify::WorkerPool::queued()
+{
+    unique_lock<mutex> guard(lock);
+    return jobs.size();
+}
+
+void Identify::WorkerPool::wait()
+{
+    unique_lock<mutex> guard(lock);
+    allDone.wait(guard, [this] { return jobs.empty() && busy == 0; });
+}
+
+void Identify::WorkerPool::run()
+{
+    while (true)
+    {
+        Job job;
+        {
+            unique_lock<mutex> guard(lock);
+            jobReady.wait(guard, [this] { return stopping || !jobs.empty(); });
+            if (jobs.empty())
+                return; // stopping, and nothing left to drain
+            job = jobs.front();
+            jobs.pop_front();
+            busy++;
+        }
+
+        try
+        {
+            job();
+        }
+        catch (std::exception& e)
+        {
+            LOG_INFO("WorkerPool: job threw exception: %s", e.what());
+        }
+        job = nullptr; // release what it captured before wait() can return
+
+        {
+            unique_lock<mutex> guard(lock);
+            busy--;
+            if (jobs.empty() && busy == 0)
+                allDone.notify_all();
+        }
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef IDENTIFY_WORKER_POOL_H
+#define IDENTIFY_WORKER_POOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <vector>
+
+namespace Identify
+{
+    //! A fixed set of threads draining a FIFO of jobs.
+    class WorkerPool
+    {
+        public:
+            typedef std::function<void()> Job;
+
+            //! @param threads number of workers (0 = one per hardware thread)
+            WorkerPool(unsigned threads = 0);
+            ~WorkerPool();
+
+            //! queue a job for the next idle worker
+            void submit(const Job& job);
+
+            //! block until every submitted job has completed
+            void wait();
+
+            //! number of jobs waiting for a worker
+            size_t queued();
+
+            unsigned size() const { return (unsigned) workers.size(); }
+
+        private:
+            void run();
+
+            std::vector<std::thread> workers;
+            std::deque<Job> jobs;
+            std::mutex lock;
+            std::condition_variable jobReady;
+            std::condition_variable allDone;
+            unsigned busy = 0;
+            bool stopping = false;
+    };
+}
+
+#endif
@@ -1,15 +1,30 @@
 #ifdef _WIN32
 #include "save\getopt.h"
+#include <io.h>
 #else
 #include <getopt.h>
+#include <unistd.h>
 #endif
 
 #include "StreamRequestJSON.h"
 #include "Spectrum.h"
 #include "Library.h"
+#include "ResponseWriter.h"
+#include "SocketServer.h"
+#include "ShmTransport.h"
+#include "LiveStream.h"
+#include "WorkerPool.h"
+#include "Metrics.h"
+#include "Bench.h"
+#include "Batch.h"
+#include "BatchWriter.h"
 #include "Util.h"
 
+#include <algorithm>
+#include <memory>
+#include <iostream>
 #include <string>
+#include <vector>
 #include <list>
 
 #include <stdio.h>
@@ -18,21 +33,49 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 
 using std::string;
 using std::list;
+using std::vector;
+using std::shared_ptr;
 
 const char* VERSION = "RamanIDAlgo-1.2.0";
 
 //! holds parsed command-line options controlling runtime behavior
 struct Options
 {
-    string libraryPath;     //!< directory containing library spectra
+    string libraryPath;     //!< directory containing library spectra (or a compiled peak list)
     string logfile;         //!< path to which log should be written
+    string listenPath;      //!< serve the streaming protocol on this Unix-domain socket
+    string connectPath;     //!< relay stdin/stdout to a server on this socket
+    string shmName;         //!< serve requests from this POSIX shared-memory segment
+    string shmProducer;     //!< act as a test producer for this shared-memory segment
+    string metricsFile;     //!< write metrics here rather than stderr
+    int iterations = 0;     //!< times to repeat each sample when benchmarking (0 = mode default)
     list<const char*> files;//!< measurements to analyze
+    unsigned threads = 0;   //!< worker threads for requests with ids (0 = auto)
+    unsigned jobs = 1;      //!< worker threads for batch mode (0 = auto)
+    bool unordered = false; //!< batch results in completion order
+    bool recursive = false; //!< batch-process *.csv beneath directories given as files
+    string manifest;        //!< batch-process the paths listed in this file ("-" for stdin)
+    string outputPath;      //!< write batch results here rather than stdout
+    Identify::BatchWriter::Format outputFormat = Identify::BatchWriter::TEXT;
+    int maxResults = 1;     //!< matches reported per sample in batch mode
+    bool timing = false;    //!< report per-stage timings per sample in batch mode
+    unsigned prefetch = 0;  //!< batch files to read ahead of the workers (0 = none)
+    unsigned prefetchKB = 1024; //!< largest file to prefetch
+    bool prefetchThreads = false; //!< prefetch with threads even if io_uring is available
+    string cachePath;       //!< reuse and keep batch results in this store
+    string watchDir;        //!< batch-process *.csv files as they're written here
+    bool csvStdin = false;  //!< batch-process CSV spectra streamed to stdin ("-" as a sample)
     bool help = false;      //!< show help
     bool verbose = false;   //!< include debug output
     bool streaming = false; //!< read streaming spectra from stdin
+    bool live = false;      //!< streaming, but only the newest pending request is identified
+    int livePatience = 50;  //!< ms in-flight work may run once superseded in live mode
+    bool metrics = false;   //!< collect streaming metrics, dumped on SIGUSR1 and at exit
+    bool bench = false;     //!< time identification of the given samples
 };
 
 //! display command-line usage
@@ -40,7 +83,15 @@ void usage(const char* progname)
 {
     printf("%s %s (C) 2022, Wasatch Photonics\n", progname, VERSION);
     printf("\n");
-    printf("Usage: %s [--verbose] [--streaming] [--logfile path] --library /path/to/library [sample.csv...]\n", progname);
+    printf("Usage: %s [--verbose] [--streaming] [--live] [--metrics] [--metrics-file path] [--threads n] [--logfile path] --library /path/to/library [sample.csv...]\n", progname);
+    printf("       %s [--verbose] [--jobs n] [--unordered] [--recursive] [--manifest paths.txt] [--logfile path]\n"
+           "           [--output-format text|ndjson|csv|bin] [--max-results k] [--timing] [--output path]\n"
+           "           [--prefetch n] [--prefetch-buffer KB] [--prefetch-threads] [--cache path] [--watch dir] [--csv-stdin] --library /path/to/library [sample.csv|dir|-...]\n", progname);
+    printf("       %s [--verbose] [--threads n] [--logfile path] --library /path/to/library --listen /path/to.sock\n", progname);
+    printf("       %s --connect /path/to.sock\n", progname);
+    printf("       %s [--verbose] [--logfile path] --library /path/to/library --shm name\n", progname);
+    printf("       %s --shm-producer name [--iterations n] [--library /path/to/library] sample.csv...\n", progname);
+    printf("       %s --bench [--iterations n] --library /path/to/library sample.csv...\n", progname);
     printf("       %s --help\n", progname);
     printf("\n");
     printf("NOTE:  This version has been modified from the original in the following key respects:\n");
@@ -54,6 +105,41 @@ void usage(const char* progname)
     printf("\n"
            "Options:\n"
            "    --streaming read streaming spectra from stdin\n"
+           "    --live      streaming, identifying only the newest request (others are \"skipped\")\n"
+           "    --live-patience ms before superseded in-flight work is cancelled (default 50)\n"
+           "    --listen    serve the streaming protocol to many clients on a Unix socket\n"
+           "    --connect   relay streaming stdin/stdout to a --listen server\n"
+           "    --shm       serve float32 spectra from a POSIX shared-memory ring\n"
+           "    --shm-producer  send samples through a --shm server and report latency\n"
+           "                (with --library, compare against the --streaming stdin path)\n"
+           "    --bench     report throughput, latency, allocations and memory identifying\n"
+           "                the samples (directly, and through the --streaming path)\n"
+           "    --iterations    times to send each sample (default 1, or 100 for --bench)\n"
+           "    --threads   workers for streamed requests with an \"id\" (default: all cores)\n"
+           "    --jobs      workers for batch mode (default 1, 0 = all cores); results are\n"
+           "                still printed in argument order\n"
+           "    --unordered print batch results as each file finishes\n"
+           "    --recursive batch-process every *.csv beneath directories given as samples\n"
+           "    --manifest  batch-process the paths listed one per line in this file\n"
+           "                (\"-\" for stdin), as they are read\n"
+           "    --output-format batch results as text (default), ndjson, csv or bin\n"
+           "    --max-results   matches per sample in ndjson/csv/bin output (default 1)\n"
+           "    --timing    include per-stage timings in ndjson/csv/bin output\n"
+           "    --output    write batch results to this file instead of stdout\n"
+           "    --prefetch  batch files to read ahead of the workers (default 0 = none),\n"
+           "                with io_uring where available; throughput goes to stderr\n"
+           "    --prefetch-buffer   largest file to prefetch, in KB (default 1024)\n"
+           "    --prefetch-threads  prefetch with a thread pool rather than io_uring\n"
+           "    --watch     batch-process each *.csv as it's written to (or moved into)\n"
+           "                this directory, until interrupted (after any samples given)\n"
+           "    --csv-stdin batch-process CSV spectra written to stdin (also given as a\n"
+           "                sample \"-\"), each ended by a blank line or the next one's\n"
+           "                metadata, after any other samples\n"
+           "    --cache     keep batch results in this file, and reuse them for files\n"
+           "                unchanged since (re-scoring them if the library has changed)\n"
+           "    --metrics   keep streaming counters and latency histograms, dumped as JSON\n"
+           "                to stderr on SIGUSR1 and at exit\n"
+           "    --metrics-file  dump metrics to this file instead (implies --metrics)\n"
            "    --verbose   include debugging output\n"
            "    --logfile   path to log debug messages\n"
            "\n");               
@@ -74,11 +160,36 @@ Options parseArgs(int argc, char **argv)
     {
         int option_index = 0;
         static struct option long_options[] = {
+           {"bench",          no_argument,       0,  0 },
+           {"cache",          required_argument, 0,  0 },
            {"help",           no_argument,       0,  0 },
+           {"iterations",     required_argument, 0,  0 },
+           {"jobs",           required_argument, 0,  0 },
+           {"connect",        required_argument, 0,  0 },
+           {"csv-stdin",      no_argument,       0,  0 },
            {"library",        required_argument, 0,  0 },
+           {"live",           no_argument,       0,  0 },
+           {"live-patience",  required_argument, 0,  0 },
+           {"listen",         required_argument, 0,  0 },
            {"logfile",        required_argument, 0,  0 },
+           {"manifest",       required_argument, 0,  0 },
+           {"metrics",        no_argument,       0,  0 },
+           {"metrics-file",   required_argument, 0,  0 },
+           {"max-results",    required_argument, 0,  0 },
+           {"output",         required_argument, 0,  0 },
+           {"output-format",  required_argument, 0,  0 },
+           {"prefetch",       required_argument, 0,  0 },
+           {"prefetch-buffer",required_argument, 0,  0 },
+           {"prefetch-threads",no_argument,      0,  0 },
+           {"recursive",      no_argument,       0,  0 },
+           {"shm",            required_argument, 0,  0 },
+           {"shm-producer",   required_argument, 0,  0 },
            {"streaming",      no_argument,       0,  0 },
+           {"threads",        required_argument, 0,  0 },
+           {"timing",         no_argument,       0,  0 },
+           {"unordered",      no_argument,       0,  0 },
            {"verbose",        no_argument,       0,  0 },
+           {"watch",          required_argument, 0,  0 },
 
            // these aren't actually implemented -- required for compatibility with plug-in API
            {"unknown-thresh", required_argument, 0,  0 },
@@ -98,19 +209,54 @@ Options parseArgs(int argc, char **argv)
             {
                 string value(optarg);
                      if (key == "library") opts.libraryPath  = value;
+                else if (key == "listen" ) opts.listenPath   = value;
+                else if (key == "connect") opts.connectPath  = value;
+                else if (key == "shm"    ) opts.shmName      = value;
+                else if (key == "shm-producer") opts.shmProducer = value;
+                else if (key == "iterations") opts.iterations = atoi(value.c_str());
+                else if (key == "live-patience") opts.livePatience = atoi(value.c_str());
                 else if (key == "logfile") opts.logfile      = value;
+                else if (key == "metrics-file") { opts.metricsFile = value; opts.metrics = true; }
+                else if (key == "threads") opts.threads      = atoi(value.c_str());
+                else if (key == "jobs"   ) opts.jobs         = atoi(value.c_str());
+                else if (key == "manifest") opts.manifest    = value;
+                else if (key == "cache"  ) opts.cachePath    = value;
+                else if (key == "watch"  ) opts.watchDir     = value;
+                else if (key == "output" ) opts.outputPath   = value;
+                else if (key == "max-results") opts.maxResults = atoi(value.c_str());
+                else if (key == "prefetch") opts.prefetch    = atoi(value.c_str());
+                else if (key == "prefetch-buffer") opts.prefetchKB = atoi(value.c_str());
+                else if (key == "output-format")
+                {
+                    if (!Identify::BatchWriter::parseFormat(value, opts.outputFormat))
+                        opts.help = true;
+                }
             }
             else
             {
                      if (key == "help"      ) opts.help      = true;
+                else if (key == "bench"     ) opts.bench     = true;
                 else if (key == "streaming" ) opts.streaming = true;
+                else if (key == "live"      ) opts.live      = opts.streaming = true;
                 else if (key == "verbose"   ) opts.verbose   = true;
+                else if (key == "metrics"   ) opts.metrics   = true;
+                else if (key == "unordered" ) opts.unordered = true;
+                else if (key == "recursive" ) opts.recursive = true;
+                else if (key == "timing"    ) opts.timing    = true;
+                else if (key == "prefetch-threads") opts.prefetchThreads = true;
+                else if (key == "csv-stdin" ) opts.csvStdin  = true;
             }
         }
     }
 
     while (optind < argc)
-        opts.files.push_back(argv[optind++]);
+    {
+        const char* arg = argv[optind++];
+        if (!strcmp(arg, "-"))
+            opts.csvStdin = true;
+        else
+            opts.files.push_back(arg);
+    }
 
     return opts;
 }
@@ -123,23 +269,78 @@ int main(int argc, char** argv)
 {
     // parse args
     Options opts = parseArgs(argc, argv);
-    if (opts.help || !opts.libraryPath.size() || (!opts.streaming && !opts.files.size()))
+    if (opts.help)
         usage(argv[0]);
 
     Util::logging_enabled = opts.verbose;
     Util::set_logfile(opts.logfile);
 
+    // a thin client needs no library of its own
+    if (opts.connectPath.size())
+        return Identify::SocketServer::connect(opts.connectPath);
+
+    // likewise the shared-memory test producer (the library is only used to
+    // spawn a --streaming child for comparison)
+    if (opts.shmProducer.size())
+        return Identify::ShmTransport::produce(opts.shmProducer, opts.files, opts.iterations ? opts.iterations : 1, opts.libraryPath, argv[0]);
+
+    if (!opts.libraryPath.size() || (!opts.streaming && !opts.listenPath.size() && !opts.shmName.size() && !opts.files.size() && !opts.manifest.size() && !opts.watchDir.size() && !opts.csvStdin))
+        usage(argv[0]);
+
+    // --bench times loading the library itself
+    if (opts.bench)
+        return Identify::Bench::run(opts.libraryPath, opts.files, opts.iterations ? opts.iterations : 100);
+
     // initialize library
     Identify::Library library(opts.libraryPath);
 
-    if (opts.streaming)
+    if (opts.shmName.size())
+    {
+        Identify::ShmTransport transport(opts.shmName, true);
+        return transport.serve(library);
+    }
+    else if (opts.listenPath.size())
+    {
+        // one resident library shared by every client
+        Identify::WorkerPool pool(opts.threads);
+        Identify::SocketServer server(library, pool);
+        return server.listen(opts.listenPath);
+    }
+    else if (opts.streaming)
     {
         ////////////////////////////////////////////////////////////////////////
         // This path is only used from ENLIGHTEN
         ////////////////////////////////////////////////////////////////////////
 
+        // responses are flushed in one write whenever no more input is
+        // already buffered (so stdin must be buffered independently of stdio)
+        Identify::ResponseWriter writer;
+        std::ios::sync_with_stdio(false);
+
+        std::unique_ptr<Identify::Metrics> metrics;
+        if (opts.metrics)
+        {
+            metrics.reset(new Identify::Metrics(library, opts.metricsFile));
+            writer.setMetrics(metrics.get());
+        }
+
         // RamanID plugin checks for line containing "ready" (doesn't have to be in JSON)
-        printf("{ \"Status\": \"ready\" }\n"); 
+        writer.writeStatus("ready");
+        writer.flush();
+
+        if (opts.live)
+        {
+            Identify::LiveStream live(library, writer, opts.livePatience);
+            live.run(std::cin);
+            writer.writeStatus("done");
+            writer.flush();
+            return 0;
+        }
+
+        // requests without an id are answered inline, in order; requests
+        // with an id go to the pool and are answered as soon as they finish
+        Identify::WorkerPool pool(opts.threads);
+        shared_ptr<Identify::StreamRequestJSON> request;
         while (true)
         {
             if (std::cin.eof())
@@ -147,61 +348,117 @@ int main(int argc, char** argv)
 
             try
             {
-                Identify::StreamRequestJSON request(std::cin);
-                if (!request.valid || request.isQuit)
+                // re-use the previous request's buffers unless a worker still holds it
+                if (request && request.use_count() == 1)
+                    request->reload(std::cin);
+                else
+                    request.reset(new Identify::StreamRequestJSON(std::cin));
+
+                if (!request->valid && request->error.size())
                 {
-                    Util::log("main: bad request (valid %s, isQuit %s)", 
-                        request.valid  ? "true" : "false", 
-                        request.isQuit ? "true" : "false");
+                    writer.writeError(*request);
+                    if (std::cin.rdbuf()->in_avail() <= 0)
+                        writer.flush();
+                    continue;
+                }
+
+                if (!request->valid || request->isQuit)
+                {
+                    LOG_DEBUG("main: bad request (valid %s, isQuit %s)", 
+                        request->valid  ? "true" : "false", 
+                        request->isQuit ? "true" : "false");
                     break;
                 }
 
-                // original
-                float score = 0;
-                string name = library.identify(request.spectrum, score);
-                if (name.size() >= 0 && score >= request.min_confidence)
-                    printf("{ \"MatchResult\": [ { \"Name\": \"%s\", \"Score\": %.2f } ] }\n", name.c_str(), score);
+                if (request->hasId())
+                {
+                    // the last job out of the queue flushes for everyone
+                    pool.submit([&library, &writer, &pool, request]() 
+                    { 
+                        writer.respond(library, *request);
+                        if (pool.queued() == 0)
+                            writer.flush();
+                    });
+                }
                 else
-                    printf("{ \"MatchResult\": [ ] }\n");
+                {
+                    writer.respond(library, *request);
+                    if (std::cin.rdbuf()->in_avail() <= 0)
+                        writer.flush();
+                }
             }
             catch (std::exception &e)
             {
-                Util::log("ERROR: exception parsing streamed input: %s", e.what());
+                LOG_INFO("ERROR: exception parsing streamed input: %s", e.what());
                 break;
             }
         }
-        printf("{ \"Status\": \"done\" }\n"); 
+        pool.wait();
+        writer.writeStatus("done");
+        writer.flush();
     }
     else
     {
-        // process each spectrum on the cmd-line
-        Util::log("------------------------------------------");
-        Util::log("Processing input files");
-        Util::log("------------------------------------------");
+        // files (and directories) on the command-line, then the manifest, then
+        // whatever arrives in the watched directory (which is watched from
+        // now, so nothing written meanwhile is missed), or the spectra on stdin
+        Identify::ChainPathSource source;
+        source.add(new Identify::ListPathSource(opts.files, opts.recursive));
+        if (opts.manifest.size())
+            source.add(new Identify::ManifestPathSource(opts.manifest));
+        bool watching = opts.watchDir.size() > 0;
+        if (opts.csvStdin && (watching || opts.manifest == "-"))
+        {
+            fprintf(stderr, "--csv-stdin can't be combined with --watch or --manifest -\n");
+            return 1;
+        }
+        if (watching)
+        {
+            Identify::WatchPathSource* watch = new Identify::WatchPathSource(opts.watchDir);
+            source.add(watch);
+            if (!watch->valid())
+                return 1;
+        }
 
-        for (auto& pathname : opts.files)
+        // (a long-running watch appends, so a restart doesn't lose results)
+        int fd = 1;
+        if (opts.outputPath.size())
         {
-            struct stat s;
-            if (stat(pathname, &s) == 0)
+            fd = open(opts.outputPath.c_str(), O_WRONLY | O_CREAT | (watching ? O_APPEND : O_TRUNC), 0644);
+            if (fd < 0)
             {
-                if (s.st_mode & S_IFDIR)
-                {
-                    Util::log("Skipping directory");
-                    continue;
-                }
+                fprintf(stderr, "unable to write %s\n", opts.outputPath.c_str());
+                return 1;
             }
+        }
 
-            // load the measurement to process
-            Identify::Spectrum measurement(pathname);
+        Identify::BatchWriter writer(library, opts.outputFormat, opts.maxResults, opts.timing, fd);
+        Identify::Batch batch(library, writer, opts.jobs, opts.unordered);
+        if (watching)
+            writer.setInteractive(true);
 
-            float score = 0;
-            string name = library.identify(measurement, score);
-            if (name.size() > 0)
-                printf("sample %s: matched library %s with score %.2f\n", measurement.name.c_str(), name.c_str(), score);
-            else
-                printf("sample %s: NO MATCH\n", measurement.name.c_str());
-            
-            Util::log("");
+        // a pipeline wants each spectrum's result as soon as it's written
+        // (but not a file redirected to stdin, which is just a batch)
+        std::unique_ptr<Identify::CSVStream> stream;
+        if (opts.csvStdin)
+        {
+            stream.reset(new Identify::CSVStream(0));
+            batch.setStream(stream.get());
+            struct stat s;
+            if (fstat(0, &s) != 0 || (s.st_mode & S_IFMT) != S_IFREG)
+                writer.setInteractive(true);
+        }
+        if (opts.prefetch && !watching) // (files arrive one at a time, so there's nothing to read ahead)
+            batch.setPrefetch(opts.prefetch, (size_t) std::max(1u, opts.prefetchKB) * 1024, opts.prefetchThreads);
+        std::unique_ptr<Identify::ResultStore> store;
+        if (opts.cachePath.size())
+        {
+            store.reset(new Identify::ResultStore(opts.cachePath, Identify::Library::sampleParameters()));
+            batch.setStore(store.get());
         }
+        int result = batch.run(source);
+        if (fd != 1)
+            close(fd);
+        return result;
     }
 }